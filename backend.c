@@ -1,23 +1,421 @@
 #include <IOKit/IOKitLib.h>
 #include <IOKit/IOTypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "multitouch.h"
 #include "backend.h"
+#include "budget.h"
+#include "classify.h"
+#include "decode.h"
+#include "emit.h"
+#include "filter.h"
+#include "handoff.h"
+#include "recognize.h"
+#include "stats.h"
+#include "trace.h"
+#include "watchdog.h"
 
-// Global variable to track the current number of fingers touching the trackpad
-static int current_fingers = 0;
+// Devices beyond this are released right away, one bit of click_decision is used per device.
+#define MAX_DEVICES 64
+
+// Tunables below can be overridden with -D when building, e.g. to sweep them over replays.
+
+// Positions are compared on a POS_QUANT x POS_QUANT grid so sensor noise doesn't count as change.
+#ifndef POS_QUANT
+#define POS_QUANT 32
+#endif
+// contact_key keeps each cell in a byte, and a contact on the far edge lands in cell POS_QUANT.
+#if POS_QUANT > 255
+#error "POS_QUANT must be at most 255"
+#endif
+// 0 hands every frame to the decision stage, to measure what dropping unchanged ones saves.
+#ifndef SUPPRESS_UNCHANGED
+#define SUPPRESS_UNCHANGED 1
+#endif
+// Magic Mouse contacts closer than this to the side edges, behind this line or larger than
+// this are part of the grip rather than a deliberate finger on the front of the shell.
+#ifndef GRIP_EDGE
+#define GRIP_EDGE 0.15f
+#endif
+#ifndef GRIP_REAR
+#define GRIP_REAR 0.45f
+#endif
+#ifndef GRIP_SIZE
+#define GRIP_SIZE 2.0f
+#endif
+// One Euro filter of each device class: cutoff in Hz of a resting contact, added cutoff per
+// surface width per second of speed and cutoff of the speed estimate. The Magic Mouse
+// surface is small and its contacts are dragged along by the hand, so it smooths harder.
+#ifndef FILTER_TRACKPAD_MIN_CUTOFF
+#define FILTER_TRACKPAD_MIN_CUTOFF 5.0f
+#endif
+#ifndef FILTER_TRACKPAD_BETA
+#define FILTER_TRACKPAD_BETA 20.0f
+#endif
+#ifndef FILTER_MOUSE_MIN_CUTOFF
+#define FILTER_MOUSE_MIN_CUTOFF 3.0f
+#endif
+#ifndef FILTER_MOUSE_BETA
+#define FILTER_MOUSE_BETA 10.0f
+#endif
+#ifndef FILTER_D_CUTOFF
+#define FILTER_D_CUTOFF 1.0f
+#endif
+// Frames trailing the newest frame of any device by more than this many seconds are late.
+#ifndef MAX_FRAME_DELAY
+#define MAX_FRAME_DELAY 0.05
+#endif
+// Seconds the newest frame has to be ahead before the watermark moves.
+#ifndef WATERMARK_STEP
+#define WATERMARK_STEP (MAX_FRAME_DELAY / 8)
+#endif
+// Least and most nanoseconds between two device rebuilds for clicks that came without frames.
+#ifndef WATCHDOG_DEVICE_BACKOFF
+#define WATCHDOG_DEVICE_BACKOFF 10000000000ull
+#endif
+#ifndef WATCHDOG_DEVICE_MAX_BACKOFF
+#define WATCHDOG_DEVICE_MAX_BACKOFF 600000000000ull
+#endif
+
+// Compact fingerprint of the last frame that was let through.
+struct frame_sig {
+	int len;
+	uint32_t contacts[MAX_CONTACTS];
+};
+
+enum device_class {
+	DEVICE_TRACKPAD,
+	DEVICE_MOUSE,
+};
+
+enum device_transport {
+	TRANSPORT_OTHER,
+	TRANSPORT_USB,
+	TRANSPORT_BLUETOOTH,
+};
+
+// What a device is, queried once at attach time so the frame path never does any I/O.
+struct device_profile {
+	uint8_t class;
+	uint8_t transport;
+	bool builtin;
+	int family;
+	int product;
+	int width;  // sensor surface in hundredths of a millimeter
+	int height;
+};
+
+// Per-device frame state. A slot is only written by the callbacks of its own device
+// and sits on its own cache line, so devices never contend with each other.
+struct device_slot {
+	struct device_profile profile;
+	struct frame_sig last_frame;
+	struct filter_state filter;
+	double last_timestamp;
+	bool middle;
+	bool resting;
+	struct stats_frames frames;
+} __attribute__((aligned(64)));
+
+struct mt_devices {
+	CFMutableArrayRef array;
+	CFIndex len;
+	int ids[MAX_DEVICES];
+	struct device_slot slots[MAX_DEVICES];
+};
+
+// Decision word precomputed by the frame side and read by the event tap: bit i is set
+// while the contacts on device slot i call for a middle click. The tap only ever does a
+// single load of it, so the work done per click stays constant no matter how the gesture
+// logic grows.
+static _Atomic uint64_t click_decision = 0;
+
+// Timestamp of the newest frame from any device, give or take WATERMARK_STEP, stored as the
+// bits of a non-negative double so that integer ordering matches. Only moves with stats on.
+static _Atomic uint64_t watermark = 0;
+
+// Whether the button currently held down was turned into a middle click. Only the tap writes
+// it, and stop_click_loop once the tap is gone.
+static _Atomic bool is_middle_click = false;
+// Bit i is set while device slot i has contacts on it, only used to attribute accounting to
+// a state. Like click_decision it is only written when a device goes from or to resting.
+static _Atomic uint64_t resting_devices = 0;
+// Frame counts of the devices released so far, the report adds those of the current ones.
+static struct stats_frames retired_frames;
+// Left clicks seen by the tap, the watchdog expects frames to come with them.
+static _Atomic uint64_t left_clicks = 0;
+// Set by stop_click_loop, run_click_loop returns instead of bringing the tap back and the
+// watchdog stops expecting heartbeats.
+static _Atomic bool click_loop_stopped = false;
+// Held while state->devices or state->port is replaced or walked. The device notification
+// fires on the main run loop and the watchdog rebuilds from the click loop, either would
+// otherwise release what the other is using. Touch callbacks go through the registry instead.
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct filter_params filter_params[] = {
+	[DEVICE_TRACKPAD] = {FILTER_TRACKPAD_MIN_CUTOFF, FILTER_TRACKPAD_BETA, FILTER_D_CUTOFF},
+	[DEVICE_MOUSE] = {FILTER_MOUSE_MIN_CUTOFF, FILTER_MOUSE_BETA, FILTER_D_CUTOFF},
+};
+
+static inline bool decide(int nFingers) {
+	return nFingers == 3;
+}
+
+// On a Magic Mouse the whole hand rests on the surface, so only touching contacts on the
+// front of the shell away from the sides count as fingers.
+static inline bool grip_finger(const struct contact *c) {
+	return (c->state == STATE_MAKE_TOUCH || c->state == STATE_TOUCHING)
+		& (c->x >= GRIP_EDGE) & (c->x <= 1 - GRIP_EDGE)
+		& (c->y >= GRIP_REAR) & (c->size <= GRIP_SIZE);
+}
+
+static inline int mouse_fingers(const struct contact *contacts, int n) {
+	int count = 0;
+
+	for (int i = 0; i < n; i++) {
+		count += grip_finger(&contacts[i]);
+	}
+	return count;
+}
+
+// The grip model, or the plain finger count while the model runs over budget. The model
+// only ever takes contacts away, so below three there is nothing for it to decide.
+static inline int grip_fingers(const struct contact *contacts, int n, int nFingers) {
+	if (nFingers < 3) {
+		return nFingers;
+	}
+	uint64_t start = stats_clock(CLOCK_MONOTONIC);
+	if (!budget_allow(BUDGET_GRIP, start)) {
+		return nFingers;
+	}
+	budget_fault(BUDGET_GRIP);
+	int count = mouse_fingers(contacts, n);
+	budget_charge(BUDGET_GRIP, start, stats_clock(CLOCK_MONOTONIC));
+	return count;
+}
+
+static inline void publish_resting(int slot, struct device_slot *s, bool resting) {
+	if (s->resting == resting) {
+		return;
+	}
+	s->resting = resting;
+	if (resting) {
+		atomic_fetch_or_explicit(&resting_devices, UINT64_C(1) << slot, memory_order_relaxed);
+	} else {
+		atomic_fetch_and_explicit(&resting_devices, ~(UINT64_C(1) << slot), memory_order_relaxed);
+	}
+}
+
+static inline void publish_decision(int slot, struct device_slot *s, bool middle) {
+	// Only touch the word shared with the tap when this device changes its mind.
+	if (s->middle == middle) {
+		return;
+	}
+	s->middle = middle;
+	if (middle) {
+		atomic_fetch_or_explicit(&click_decision, UINT64_C(1) << slot, memory_order_release);
+	} else {
+		atomic_fetch_and_explicit(&click_decision, ~(UINT64_C(1) << slot), memory_order_release);
+	}
+}
+
+// On a mouse the top bit of the state byte tells whether the grip model counts the contact,
+// so a contact crossing a grip threshold within one grid cell, or only growing past
+// GRIP_SIZE, still counts as change. Contact states fit in the lower bits.
+static inline uint32_t contact_key(const struct contact *c, bool mouse) {
+	uint32_t qx = (int)(c->x * POS_QUANT) & 0xff;
+	uint32_t qy = (int)(c->y * POS_QUANT) & 0xff;
+	uint32_t grip = mouse && grip_finger(c);
+	return (c->identifier & 0xff) << 24 | (grip << 7 | (c->state & 0x7f)) << 16 | qx << 8 | qy;
+}
+
+// Returns true if the frame differs from the previous one in a way downstream cares about.
+static inline bool frame_changed(struct frame_sig *last_frame, const struct contact *contacts, int n, int nFingers,
+	bool mouse) {
+	struct frame_sig sig = {.len = nFingers};
+
+	for (int i = 0; i < n; i++) {
+		sig.contacts[i] = contact_key(&contacts[i], mouse);
+	}
+	if (sig.len == last_frame->len && memcmp(sig.contacts, last_frame->contacts, n * sizeof(uint32_t)) == 0) {
+		return false;
+	}
+	*last_frame = sig;
+	return true;
+}
+
+static inline enum stats_state activity() {
+	if (atomic_load_explicit(&is_middle_click, memory_order_relaxed)) {
+		return STATS_CLICKING;
+	}
+	return atomic_load_explicit(&resting_devices, memory_order_relaxed) != 0 ? STATS_RESTING : STATS_IDLE;
+}
+
+// Advances the watermark and tells whether the frame trails the newest frame of any device by
+// more than MAX_FRAME_DELAY.
+static inline bool frame_trailing(double timestamp) {
+	uint64_t bits;
+	memcpy(&bits, &timestamp, sizeof(bits));
+
+	// The mark moves in steps of WATERMARK_STEP so devices don't take turns writing its cache
+	// line on every frame, frames are counted late that much more leniently.
+	uint64_t mark = atomic_load_explicit(&watermark, memory_order_relaxed);
+	double newest;
+	memcpy(&newest, &mark, sizeof(newest));
+	while (timestamp >= newest + WATERMARK_STEP && !atomic_compare_exchange_weak_explicit(&watermark, &mark, bits,
+		memory_order_relaxed, memory_order_relaxed)) {
+		memcpy(&newest, &mark, sizeof(newest));
+	}
+	return timestamp < newest - MAX_FRAME_DELAY;
+}
+
+// Tells whether the frame is behind an earlier frame of the same device, which makes it stale.
+// Frames trailing the other devices are counted late but still applied, they are the newest
+// word of their own device and its vote rests on them. Only the stats report tells them, so
+// the watermark all devices share is only kept while it is on.
+static inline bool frame_stale(struct device_slot *s, double timestamp) {
+	if (timestamp <= s->last_timestamp) {
+		stats_count(&s->frames.late);
+		return true;
+	}
+	if (stats_enabled && frame_trailing(timestamp)) {
+		stats_count(&s->frames.late);
+	}
+	s->last_timestamp = timestamp;
+	return false;
+}
+
+static inline void process_frame(int slot, struct device_slot *s, struct finger *fingers, int nFingers, double timestamp, int frame) {
+	stats_count(&s->frames.seen);
+	if (frame_stale(s, timestamp)) {
+		return;
+	}
+
+	struct contact contacts[MAX_CONTACTS];
+	frame_decoder decode = atomic_load_explicit(&decode_frame, memory_order_relaxed);
+	int n = decode(fingers, nFingers, frame, timestamp, contacts, MAX_CONTACTS);
+	if (trace_enabled) {
+		uint64_t start = stats_clock(CLOCK_MONOTONIC);
+		if (budget_allow(BUDGET_TRACE_FRAME, start)) {
+			budget_fault(BUDGET_TRACE_FRAME);
+			trace_frame(slot, timestamp, contacts, n, nFingers * sizeof(struct finger));
+			budget_charge(BUDGET_TRACE_FRAME, start, stats_clock(CLOCK_MONOTONIC));
+		}
+	}
+	// Traces keep the raw positions, so filters can be compared on replays.
+	if (filter_enabled) {
+		filter_frame(&s->filter, &filter_params[s->profile.class], timestamp, contacts, n);
+	}
+	bool changed = !SUPPRESS_UNCHANGED || frame_changed(&s->last_frame, contacts, n, nFingers,
+		s->profile.class == DEVICE_MOUSE);
+
+	if (!changed) {
+		stats_count(&s->frames.suppressed);
+	} else {
+		publish_resting(slot, s, nFingers > 0);
+		if (recognize_enabled) {
+			recognize_frame(slot, timestamp, contacts, n, nFingers);
+		}
+		// A trained model stands in for the finger count on trackpads, the Magic Mouse has the
+		// grip model.
+		bool middle = s->profile.class == DEVICE_MOUSE ? decide(grip_fingers(contacts, n, nFingers))
+			: classify_enabled ? classify(&classify_model, contacts, n) : decide(nFingers);
+		publish_decision(slot, s, middle);
+	}
+}
+
+// Device registry as seen from touch_callback, published with read-copy-update semantics.
+// Readers pin the current epoch around their use of it, writers swap the pointer, flip the
+// epoch and wait for the readers still pinned to the previous one before releasing anything.
+// Readers are counted on REGISTRY_SHARDS cache lines picked by device, so the callbacks of
+// different devices don't take turns on one counter.
+#define REGISTRY_SHARD_BITS 4
+#define REGISTRY_SHARDS (1 << REGISTRY_SHARD_BITS)
+
+struct registry_shard {
+	_Atomic unsigned readers[2];
+} __attribute__((aligned(64)));
+
+static struct mt_devices *_Atomic registry = NULL;
+static _Atomic unsigned registry_epoch = 0;
+static struct registry_shard registry_shards[REGISTRY_SHARDS];
+
+static inline struct registry_shard *registry_shard(int device) {
+	return &registry_shards[(uint32_t)device * 2654435761u >> (32 - REGISTRY_SHARD_BITS)];
+}
+
+static inline unsigned registry_pin(struct registry_shard *shard) {
+	for (;;) {
+		unsigned epoch = atomic_load(&registry_epoch);
+		atomic_fetch_add(&shard->readers[epoch & 1], 1);
+		// A writer flipped the epoch in between and may not wait for us, try again.
+		if (atomic_load(&registry_epoch) == epoch) {
+			return epoch;
+		}
+		atomic_fetch_sub(&shard->readers[epoch & 1], 1);
+	}
+}
+
+static inline void registry_unpin(struct registry_shard *shard, unsigned epoch) {
+	atomic_fetch_sub_explicit(&shard->readers[epoch & 1], 1, memory_order_release);
+}
+
+// Waits until every reader that could have seen the previously published registry is gone.
+static inline void registry_synchronize() {
+	unsigned epoch = atomic_fetch_add(&registry_epoch, 1);
+	for (int i = 0; i < REGISTRY_SHARDS; i++) {
+		while (atomic_load_explicit(&registry_shards[i].readers[epoch & 1], memory_order_acquire) != 0) {
+			sched_yield();
+		}
+	}
+}
+
+// MultitouchSupport hands the MTDeviceRef to the callback truncated to an int.
+static inline int device_id(MTDeviceRef device) {
+	return (int)(intptr_t)device;
+}
+
+// Returns the slot of the device or -1 if it isn't registered.
+static inline int devices_lookup(const struct mt_devices *devices, int device) {
+	if (devices == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < devices->len; i++) {
+		if (devices->ids[i] == device) {
+			return i;
+		}
+	}
+	return -1;
+}
 
 static inline int touch_callback(int device, struct finger *fingers, int nFingers, double timestamp, int frame) {
-	current_fingers = nFingers;
+	uint64_t start = stats_begin();
+	struct registry_shard *shard = registry_shard(device);
+	unsigned epoch = registry_pin(shard);
+	struct mt_devices *devices = atomic_load_explicit(&registry, memory_order_acquire);
+	int slot = devices_lookup(devices, device);
+
+	// Frames from devices already retired by a hotplug refresh are dropped.
+	if (slot >= 0) {
+		process_frame(slot, &devices->slots[slot], fingers, nFingers, timestamp, frame);
+	}
+	registry_unpin(shard, epoch);
+	stats_record(STATS_TOUCH, activity(), start);
 	return 0;
 }
 
-static CGEventRef mouse_callback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *refcon) {
-	static bool is_middle_click = false;
-
-	if (current_fingers != 3 && !is_middle_click) {
+static inline CGEventRef rewrite_click(CGEventType type, CGEventRef event) {
+	uint64_t decision = atomic_load_explicit(&click_decision, memory_order_acquire);
+	if (recognize_enabled && type == kCGEventLeftMouseDown) {
+		decision = recognize_decision(stats_clock(TRACE_CLOCK) / 1e9, decision);
+	}
+	if (decision == 0 && !atomic_load_explicit(&is_middle_click, memory_order_relaxed)) {
 		return event;
 	}
 
@@ -26,70 +424,344 @@ static CGEventRef mouse_callback(CGEventTapProxy proxy, CGEventType type, CGEven
 		// Convert the event to a middle-click down event
 		CGEventSetType(event, kCGEventOtherMouseDown);
 		CGEventSetIntegerValueField(event, kCGMouseEventButtonNumber, kCGMouseButtonCenter);
-		is_middle_click = true;
+		atomic_store_explicit(&is_middle_click, true, memory_order_relaxed);
 		break;
 
 	case kCGEventLeftMouseUp:
 		// Convert the left mouse up to a middle mouse up
 		CGEventSetType(event, kCGEventOtherMouseUp);
 		CGEventSetIntegerValueField(event, kCGMouseEventButtonNumber, kCGMouseButtonCenter);
-		is_middle_click = false;
+		atomic_store_explicit(&is_middle_click, false, memory_order_relaxed);
 		break;
 	}
 
 	return event;
 }
 
-static struct mt_devices multitouch_devices() {
-	// Attempt to create a list of multitouch devices
-	CFMutableArrayRef devices = MTDeviceCreateList();
-	if (devices == NULL) {
-		fprintf(stderr, "Failed to create device list. No multitouch device found.\n");
-		exit(1);
+static CGEventRef mouse_callback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *refcon) {
+	struct fm_state *state = refcon;
+
+	if (type == kCGEventTapDisabledByTimeout || type == kCGEventTapDisabledByUserInput) {
+		// macOS turned the tap off, take it back right away.
+		watchdog_failed(WATCHDOG_TAP, stats_clock(WATCHDOG_CLOCK));
+		CGEventTapEnable(state->tap_event, true);
+		watchdog_recovered(WATCHDOG_TAP, stats_clock(WATCHDOG_CLOCK));
+		return event;
+	}
+	if (type == kCGEventLeftMouseDown) {
+		atomic_fetch_add_explicit(&left_clicks, 1, memory_order_relaxed);
 	}
 
-	CFIndex count = CFArrayGetCount(devices);
-	if (count == 0) {
-		fprintf(stderr, "No Multitouch devices found.\n");
-		CFRelease(devices);
-		exit(1);
+	uint64_t start = stats_begin();
+	// Attribute the event to the state it was received in.
+	enum stats_state st = activity();
+
+	event = rewrite_click(type, event);
+	if (state->drag_tap != NULL && CGEventGetType(event) != type) {
+		// The latch just changed, drags need rewriting exactly while it is set.
+		CGEventTapEnable(state->drag_tap, type == kCGEventLeftMouseDown);
+	}
+	// The click is decided by now, whatever follows is optional and must not hold the tap up.
+	uint64_t now = trace_enabled ? stats_clock(CLOCK_MONOTONIC) : 0;
+	if (trace_enabled && (type == kCGEventLeftMouseDown || type == kCGEventLeftMouseUp)
+		&& budget_allow(BUDGET_TRACE_CLICK, now)) {
+		CGEventType rewritten = CGEventGetType(event);
+		budget_fault(BUDGET_TRACE_CLICK);
+		trace_click(
+			stats_clock(TRACE_CLOCK) / 1e9,
+			type == kCGEventLeftMouseDown,
+			rewritten == kCGEventOtherMouseDown || rewritten == kCGEventOtherMouseUp
+		);
+		budget_charge(BUDGET_TRACE_CLICK, now, stats_clock(CLOCK_MONOTONIC));
+	}
+	stats_record(STATS_TAP, st, start);
+	return event;
+}
+
+// Only enabled while a middle click is latched, turns the drags in between into middle drags.
+static CGEventRef drag_callback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *refcon) {
+	struct fm_state *state = refcon;
+	bool latched = atomic_load_explicit(&is_middle_click, memory_order_relaxed);
+
+	if (type == kCGEventTapDisabledByTimeout || type == kCGEventTapDisabledByUserInput) {
+		CGEventTapEnable(state->drag_tap, latched);
+		return event;
+	}
+
+	uint64_t start = stats_begin();
+	if (type == kCGEventLeftMouseDragged && latched) {
+		CGEventSetType(event, kCGEventOtherMouseDragged);
+		CGEventSetIntegerValueField(event, kCGMouseEventButtonNumber, kCGMouseButtonCenter);
+	}
+	stats_record(STATS_DRAG, activity(), start);
+	return event;
+}
+
+// Looks key up on the service and its parents, the HID properties live on an ancestor.
+static inline CFTypeRef service_property(io_service_t service, CFStringRef key) {
+	return IORegistryEntrySearchCFProperty(
+		service,
+		kIOServicePlane,
+		key,
+		kCFAllocatorDefault,
+		kIORegistryIterateRecursively | kIORegistryIterateParents
+	);
+}
+
+static inline int service_int(io_service_t service, CFStringRef key) {
+	int value = 0;
+	CFTypeRef prop = service_property(service, key);
+
+	if (prop != NULL) {
+		if (CFGetTypeID(prop) == CFNumberGetTypeID()) {
+			CFNumberGetValue((CFNumberRef)prop, kCFNumberIntType, &value);
+		}
+		CFRelease(prop);
 	}
+	return value;
+}
+
+static inline enum device_transport service_transport(io_service_t service) {
+	enum device_transport transport = TRANSPORT_OTHER;
+	CFTypeRef prop = service_property(service, CFSTR("Transport"));
+
+	if (prop != NULL) {
+		if (CFGetTypeID(prop) == CFStringGetTypeID()) {
+			if (CFStringCompare((CFStringRef)prop, CFSTR("USB"), 0) == kCFCompareEqualTo) {
+				transport = TRANSPORT_USB;
+			} else if (CFStringCompare((CFStringRef)prop, CFSTR("Bluetooth"), 0) == kCFCompareEqualTo) {
+				transport = TRANSPORT_BLUETOOTH;
+			}
+		}
+		CFRelease(prop);
+	}
+	return transport;
+}
+
+static struct device_profile device_profile(MTDeviceRef device) {
+	struct device_profile profile = {.builtin = MTDeviceIsBuiltIn(device)};
+
+	MTDeviceGetFamilyID(device, &profile.family);
+	MTDeviceGetSensorSurfaceDimensions(device, &profile.width, &profile.height);
+	// Magic Mouse and Magic Mouse 2, everything else we get is a trackpad.
+	profile.class = profile.family == 112 || profile.family == 113 ? DEVICE_MOUSE : DEVICE_TRACKPAD;
+
+	io_service_t service = MTDeviceGetService(device);
+	if (service != IO_OBJECT_NULL) {
+		profile.product = service_int(service, CFSTR("ProductID"));
+		profile.transport = service_transport(service);
+	}
+	return profile;
+}
 
-	return (struct mt_devices) {
-		.array = devices,
+// Lists the multitouch devices there are right now, possibly none, e.g. while the only
+// one is unplugged or across a rebuild racing a hotplug.
+static struct mt_devices *multitouch_devices() {
+	CFMutableArrayRef array = MTDeviceCreateList();
+	CFIndex count = array != NULL ? CFArrayGetCount(array) : 0;
+
+	if (count > MAX_DEVICES) {
+		fprintf(stderr, "Too many Multitouch devices, ignoring %ld of them.\n", (long)(count - MAX_DEVICES));
+		for (CFIndex i = MAX_DEVICES; i < count; i++) {
+			MTDeviceRelease((MTDeviceRef)CFArrayGetValueAtIndex(array, i));
+		}
+		count = MAX_DEVICES;
+	}
+
+	struct mt_devices *devices = aligned_alloc(_Alignof(struct mt_devices), sizeof(struct mt_devices));
+	if (devices == NULL) {
+		fprintf(stderr, "Failed to allocate device list.\n");
+		exit(1);
+	}
+	*devices = (struct mt_devices) {
+		.array = array,
 		.len = count
 	};
+	for (CFIndex i = 0; i < count; i++) {
+		MTDeviceRef device = (MTDeviceRef)CFArrayGetValueAtIndex(array, i);
+		devices->ids[i] = device_id(device);
+		devices->slots[i].profile = device_profile(device);
+	}
+	return devices;
 }
 
-static inline void devices_register(struct mt_devices devices, MTContactCallback callback) {
-	for (CFIndex i = 0; i < devices.len; i++) {
-		MTDeviceRef device = (MTDeviceRef)CFArrayGetValueAtIndex(devices.array, i);
+static inline void devices_register(struct mt_devices *devices, MTContactCallback callback) {
+	atomic_store(&registry, devices);
+	for (CFIndex i = 0; i < devices->len; i++) {
+		MTDeviceRef device = (MTDeviceRef)CFArrayGetValueAtIndex(devices->array, i);
 		if (device != NULL) {
+			// Slots get reused across hotplugs, traces need to tell which device one holds.
+			const struct device_profile *p = &devices->slots[i].profile;
+			trace_device(i, &(struct trace_device) {.family = p->family, .product = p->product, .builtin = p->builtin});
 			MTRegisterContactFrameCallback(device, touch_callback);
 			MTDeviceStart(device, 0);
 		}
 	}
 }
 
-static inline void devices_cleanup(struct mt_devices devices) {
-	for (CFIndex i = 0; i < devices.len; i++) {
-		MTDeviceRef device = (MTDeviceRef)CFArrayGetValueAtIndex(devices.array, i);
+static inline void devices_stop(struct mt_devices *devices) {
+	for (CFIndex i = 0; i < devices->len; i++) {
+		MTDeviceRef device = (MTDeviceRef)CFArrayGetValueAtIndex(devices->array, i);
 		if (device != NULL) {
 			MTUnregisterContactFrameCallback(device, touch_callback);
 			MTDeviceStop(device);
+		}
+	}
+}
+
+static inline void devices_release(struct mt_devices *devices) {
+	for (CFIndex i = 0; i < devices->len; i++) {
+		MTDeviceRef device = (MTDeviceRef)CFArrayGetValueAtIndex(devices->array, i);
+		if (device != NULL) {
 			MTDeviceRelease(device);
 		}
 	}
+	free(devices);
 }
 
-static inline void devices_refresh(struct mt_devices *devices) {
-	devices_cleanup(*devices);
-	*devices = multitouch_devices();
+// Stops the current devices and publishes next in their place. The old devices are
+// released only after no touch_callback can still be looking at them.
+static inline void devices_replace(struct mt_devices **devices, struct mt_devices *next) {
+	struct mt_devices *old = *devices;
+
+	if (old != NULL) {
+		devices_stop(old);
+	}
+	atomic_store(&registry, next);
+	registry_synchronize();
+	// No device is delivering frames until next gets registered, drop the old votes.
+	atomic_store(&click_decision, 0);
+	atomic_store(&resting_devices, 0);
+	if (recognize_enabled) {
+		recognize_reset();
+	}
+	if (old != NULL) {
+		for (CFIndex i = 0; i < old->len; i++) {
+			stats_frames_add(&retired_frames, &old->slots[i].frames);
+		}
+		devices_release(old);
+	}
+	*devices = next;
+}
+
+static inline void devices_cleanup(struct mt_devices **devices) {
+	devices_replace(devices, NULL);
+}
+
+static inline void devices_refresh(struct mt_devices **devices) {
+	devices_replace(devices, multitouch_devices());
 	devices_register(*devices, touch_callback);
 }
 
 static void device_notification_callback(void *refcon, io_iterator_t iter) {
-	devices_refresh((struct mt_devices *) refcon);
+	uint64_t start = stats_begin();
+
+	pthread_mutex_lock(&devices_lock);
+	devices_refresh((struct mt_devices **) refcon);
+	pthread_mutex_unlock(&devices_lock);
+	stats_record(STATS_NOTIFY, activity(), start);
+}
+
+static void stats_timer_callback(CFRunLoopTimerRef timer, void *info) {
+	struct stats_frames frames = {0};
+	struct registry_shard *shard = registry_shard(0);
+	unsigned epoch = registry_pin(shard);
+	struct mt_devices *devices = atomic_load_explicit(&registry, memory_order_acquire);
+
+	for (CFIndex i = 0; devices != NULL && i < devices->len; i++) {
+		stats_frames_add(&frames, &devices->slots[i].frames);
+	}
+	registry_unpin(shard, epoch);
+	stats_frames_add(&frames, &retired_frames);
+
+	stats_report(stderr, &frames);
+	budget_report(stderr);
+	watchdog_report(stderr);
+	emit_report(stderr);
+	filter_report(stderr);
+	recognize_report(stderr);
+	trace_report(stderr);
+	trace_flush();
+}
+
+// Makes run_click_loop come around, from any thread.
+static void stop_run_loop(void *refcon) {
+	CFRunLoopStop(((struct fm_state *)refcon)->run_loop);
+}
+
+static inline bool same_device(const struct device_profile *p, const struct handoff_device *d) {
+	return p->family == d->family && p->product == d->product && p->width == d->width
+		&& p->height == d->height && p->class == d->class && p->transport == d->transport
+		&& p->builtin == d->builtin;
+}
+
+static inline struct handoff_config handoff_config() {
+	return (struct handoff_config) {
+		.pos_quant = POS_QUANT,
+		.grip_edge = GRIP_EDGE,
+		.grip_rear = GRIP_REAR,
+		.grip_size = GRIP_SIZE,
+		.max_frame_delay = MAX_FRAME_DELAY
+	};
+}
+
+// Called on the run loop thread once the tap is disabled, the successor takes it from here.
+static void hand_off(struct fm_state *state) {
+	struct handoff_state handoff = {
+		.middle_click = atomic_load(&is_middle_click),
+		.config = handoff_config()
+	};
+
+	pthread_mutex_lock(&devices_lock);
+	for (CFIndex i = 0; state->devices != NULL && i < state->devices->len; i++) {
+		const struct device_slot *s = &state->devices->slots[i];
+		handoff.devices[handoff.len++] = (struct handoff_device) {
+			.family = s->profile.family,
+			.product = s->profile.product,
+			.width = s->profile.width,
+			.height = s->profile.height,
+			.class = s->profile.class,
+			.transport = s->profile.transport,
+			.builtin = s->profile.builtin
+		};
+	}
+	pthread_mutex_unlock(&devices_lock);
+	handoff_release(&handoff);
+}
+
+// Takes the latched click over from the predecessor before our tap sees its first event.
+// Votes are not taken over, our devices were registered before the tap was created and any
+// resting fingers have sent us a frame by now.
+static void take_over(struct fm_state *state) {
+	struct handoff_state handoff;
+	double latency;
+	int matched = 0;
+	uint64_t used = 0;
+
+	if (!handoff_receive(&handoff, &latency)) {
+		return;
+	}
+	atomic_store(&is_middle_click, handoff.middle_click);
+
+	struct handoff_config config = handoff_config();
+	if (memcmp(&config, &handoff.config, sizeof(config)) != 0) {
+		fputs("Tunables differ from the previous build, gestures may behave differently.\n", stderr);
+	}
+
+	pthread_mutex_lock(&devices_lock);
+	for (CFIndex i = 0; state->devices != NULL && i < state->devices->len; i++) {
+		const struct device_slot *s = &state->devices->slots[i];
+		for (uint32_t j = 0; j < handoff.len && j < HANDOFF_MAX_DEVICES; j++) {
+			if ((used & UINT64_C(1) << j) == 0 && same_device(&s->profile, &handoff.devices[j])) {
+				used |= UINT64_C(1) << j;
+				matched++;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&devices_lock);
+	fprintf(stderr, "Took over from process %d in %.0fus, %d of %u devices matched.\n",
+		handoff.pid, latency * 1e6, matched, handoff.len);
 }
 
 static inline void stop_io_notifications(struct fm_state *state) {
@@ -99,7 +771,87 @@ static inline void stop_io_notifications(struct fm_state *state) {
 	}
 }
 
-static inline kern_return_t listen_io_notification(struct fm_state *state) {
+static kern_return_t listen_io_notification(struct fm_state *state);
+
+// Frames delivered by all devices so far, only ever compared for change.
+static inline uint64_t devices_frames(const struct mt_devices *devices) {
+	uint64_t frames = 0;
+
+	for (CFIndex i = 0; devices != NULL && i < devices->len; i++) {
+		frames += atomic_load_explicit(&devices->slots[i].frames.seen, memory_order_relaxed);
+	}
+	return frames;
+}
+
+// Runs on the click loop every watchdog_interval seconds: beats for the watchdog thread and
+// checks everything that can die without telling us, rebuilding only what did.
+static void watchdog_timer_callback(CFRunLoopTimerRef timer, void *info) {
+	static uint64_t last_check;
+	static uint64_t last_frames;
+	static uint64_t last_clicks;
+	static uint64_t device_backoff;
+	static uint64_t next_device_rebuild;
+	struct fm_state *state = info;
+	uint64_t now = stats_clock(WATCHDOG_CLOCK);
+	uint64_t since = last_check != 0 ? last_check : now;
+
+	if (atomic_load(&click_loop_stopped)) {
+		return;
+	}
+	watchdog_beat(now);
+
+	if (state->tap_event != NULL && !CGEventTapIsEnabled(state->tap_event)) {
+		watchdog_failed(WATCHDOG_TAP, since);
+		CGEventTapEnable(state->tap_event, true);
+	}
+	if (state->tap_event != NULL && CGEventTapIsEnabled(state->tap_event)) {
+		watchdog_recovered(WATCHDOG_TAP, stats_clock(WATCHDOG_CLOCK));
+	}
+	bool latched = atomic_load(&is_middle_click);
+	if (state->drag_tap != NULL && CGEventTapIsEnabled(state->drag_tap) != latched) {
+		CGEventTapEnable(state->drag_tap, latched);
+	}
+
+	// The main run loop is refreshing the devices, they get looked at on the next beat.
+	if (pthread_mutex_trylock(&devices_lock) != 0) {
+		last_check = now;
+		return;
+	}
+	if (state->port != NULL && !CFRunLoopSourceIsValid(IONotificationPortGetRunLoopSource(state->port))) {
+		watchdog_failed(WATCHDOG_PORT, since);
+		stop_io_notifications(state);
+		if (listen_io_notification(state) == KERN_SUCCESS) {
+			// Devices may have come and gone unnoticed in the meantime.
+			devices_refresh(&state->devices);
+			watchdog_recovered(WATCHDOG_PORT, stats_clock(WATCHDOG_CLOCK));
+		}
+	}
+
+	// Clicking takes a finger on the surface, which keeps a multitouch device sending frames,
+	// so clicks without a single frame mean our callbacks were dropped. Clicks from a plain
+	// mouse look the same, so rebuilding backs off until frames come in again.
+	uint64_t frames = devices_frames(state->devices);
+	uint64_t clicks = atomic_load_explicit(&left_clicks, memory_order_relaxed);
+	if (frames != last_frames) {
+		device_backoff = 0;
+		watchdog_recovered(WATCHDOG_DEVICES, now);
+	} else if (clicks != last_clicks && now >= next_device_rebuild) {
+		watchdog_failed(WATCHDOG_DEVICES, now);
+		devices_refresh(&state->devices);
+		device_backoff = device_backoff == 0 ? WATCHDOG_DEVICE_BACKOFF : device_backoff * 2;
+		if (device_backoff > WATCHDOG_DEVICE_MAX_BACKOFF) {
+			device_backoff = WATCHDOG_DEVICE_MAX_BACKOFF;
+		}
+		next_device_rebuild = now + device_backoff;
+		frames = devices_frames(state->devices);
+	}
+	pthread_mutex_unlock(&devices_lock);
+	last_frames = frames;
+	last_clicks = clicks;
+	last_check = now;
+}
+
+static kern_return_t listen_io_notification(struct fm_state *state) {
 	state->port = IONotificationPortCreate(kIOMainPortDefault);
 
 	// Set up device notifications
@@ -128,18 +880,61 @@ static inline kern_return_t listen_io_notification(struct fm_state *state) {
 	return kres;
 }
 
-void stop_click_loop(struct fm_state *state) {
+static void release_click_loop(struct fm_state *state) {
+	if (state->stats_timer != NULL) {
+		CFRunLoopTimerInvalidate(state->stats_timer);
+		CFRelease(state->stats_timer);
+		state->stats_timer = NULL;
+	}
+	if (state->watchdog_timer != NULL) {
+		CFRunLoopTimerInvalidate(state->watchdog_timer);
+		CFRelease(state->watchdog_timer);
+		state->watchdog_timer = NULL;
+	}
 	if (state->tap_event != NULL) {
 		CGEventTapEnable(state->tap_event, false);
 		CFRelease(state->tap_event);
 		state->tap_event = NULL;
 	}
 	if (state->run_loop_src != NULL) {
-		CFRunLoopRemoveSource(CFRunLoopGetCurrent(), state->run_loop_src, kCFRunLoopCommonModes);
+		CFRunLoopRemoveSource(state->run_loop, state->run_loop_src, kCFRunLoopCommonModes);
 		CFRelease(state->run_loop_src);
+		state->run_loop_src = NULL;
+	}
+	if (state->drag_tap != NULL) {
+		CGEventTapEnable(state->drag_tap, false);
+		CFRelease(state->drag_tap);
+		state->drag_tap = NULL;
+	}
+	if (state->drag_src != NULL) {
+		CFRunLoopRemoveSource(state->run_loop, state->drag_src, kCFRunLoopCommonModes);
+		CFRelease(state->drag_src);
+		state->drag_src = NULL;
 	}
 }
 
+// Drags only need rewriting between a middle down and up, so they get a tap of their own
+// that is off the rest of the time and ordinary mouse use never wakes us up.
+static inline void listen_drags(struct fm_state *state) {
+	state->drag_tap = CGEventTapCreate(
+		kCGHIDEventTap,
+		kCGHeadInsertEventTap,
+		kCGEventTapOptionDefault,
+		1 << kCGEventLeftMouseDragged,
+		drag_callback,
+		state
+	);
+	if (state->drag_tap != NULL) {
+		state->drag_src = CFMachPortCreateRunLoopSource(NULL, state->drag_tap, 0);
+	}
+	if (state->drag_src == NULL) {
+		fputs("Failed to create drag event tap, middle drags will stay left drags.\n", stderr);
+		return;
+	}
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), state->drag_src, kCFRunLoopCommonModes);
+	CGEventTapEnable(state->drag_tap, atomic_load(&is_middle_click));
+}
+
 static int listen_click_loop(struct fm_state *state) {
 	for (int i = 0; state->tap_event == NULL && i < 300; i++) {
 		// Create a global event tap to listen for left mouse down and up events
@@ -149,7 +944,7 @@ static int listen_click_loop(struct fm_state *state) {
 			kCGEventTapOptionDefault,
 			(1 << kCGEventLeftMouseDown) | (1 << kCGEventLeftMouseUp),
 			mouse_callback,
-			NULL
+			state
 		);
 		if (state->tap_event == NULL) {
 			sleep(1);
@@ -162,6 +957,7 @@ static int listen_click_loop(struct fm_state *state) {
 	}
 
 	// Add the event tap to the current run loop
+	state->run_loop = CFRunLoopGetCurrent();
 	state->run_loop_src = CFMachPortCreateRunLoopSource(NULL, state->tap_event, 0);
 	if (state->run_loop_src == NULL) {
 		fputs("Failed to create run loop source.", stderr);
@@ -169,42 +965,151 @@ static int listen_click_loop(struct fm_state *state) {
 	}
 
 	CFRunLoopAddSource(CFRunLoopGetCurrent(), state->run_loop_src, kCFRunLoopCommonModes);
+	// An older instance is still holding its tap, ours goes live the moment it lets go.
+	if (handoff_successor()) {
+		take_over(state);
+	}
+	listen_drags(state);
 	CGEventTapEnable(state->tap_event, true);
+	if (handoff_enabled) {
+		handoff_listen(stop_run_loop, state);
+	}
+
+	if (stats_enabled) {
+		double interval = stats_interval();
+		state->stats_timer = CFRunLoopTimerCreate(
+			NULL,
+			CFAbsoluteTimeGetCurrent() + interval,
+			interval,
+			0,
+			0,
+			stats_timer_callback,
+			NULL
+		);
+		CFRunLoopAddTimer(CFRunLoopGetCurrent(), state->stats_timer, kCFRunLoopCommonModes);
+	}
+
+	double beat = watchdog_interval();
+	state->watchdog_timer = CFRunLoopTimerCreate(
+		NULL,
+		CFAbsoluteTimeGetCurrent() + beat,
+		beat,
+		0,
+		0,
+		watchdog_timer_callback,
+		&(CFRunLoopTimerContext) {.info = state}
+	);
+	// Nothing depends on the exact moment, let it ride along with other wakeups.
+	CFRunLoopTimerSetTolerance(state->watchdog_timer, beat / 2);
+	CFRunLoopAddTimer(CFRunLoopGetCurrent(), state->watchdog_timer, kCFRunLoopCommonModes);
+
 	// Run the main loop to start receiving events
+	watchdog_beat(stats_clock(WATCHDOG_CLOCK));
 	CFRunLoopRun();
+	watchdog_idle();
 
-	// If for some reason the main loop returns we cleanup the registered events.
-	stop_click_loop(state);
+	// If for some reason the main loop returns we cleanup the registered events. The click
+	// stays latched, the tap is back before the button comes up or the successor owns it.
+	release_click_loop(state);
 	return 0;
 }
 
 struct fm_state new_state() {
-	return (struct fm_state) {.devices = multitouch_devices()};
+	stats_init();
+	budget_init();
+	emit_init();
+	filter_init();
+
+	const char *trace = getenv("FASTMIDDLE_TRACE");
+	if (trace != NULL && !trace_open(trace)) {
+		fprintf(stderr, "Failed to open trace file %s.\n", trace);
+	}
+	const char *handoff = getenv("FASTMIDDLE_HANDOFF");
+	if (handoff != NULL) {
+		handoff_init(handoff);
+	}
+	const char *model = getenv("FASTMIDDLE_MODEL");
+	if (model != NULL && !classify_load(model)) {
+		fprintf(stderr, "Failed to load click model %s.\n", model);
+	}
+	const char *recognizer = getenv("FASTMIDDLE_RECOGNIZER");
+	if (recognizer != NULL && !recognize_init(recognizer)) {
+		fprintf(stderr, "Failed to map recognizer ring %s.\n", recognizer);
+	}
+	struct mt_devices *devices = multitouch_devices();
+	if (devices->len == 0) {
+		fprintf(stderr, "No Multitouch devices found.\n");
+		exit(1);
+	}
+	return (struct fm_state) {.devices = devices};
 }
 
 void run_click_loop(struct fm_state *state) {
+	atomic_store(&click_loop_stopped, false);
+	// The devices are gone if a previous run failed, enumerate them again.
+	if (state->devices == NULL) {
+		state->devices = multitouch_devices();
+	}
 	devices_register(state->devices, touch_callback);
 
+	pthread_mutex_lock(&devices_lock);
 	if (listen_io_notification(state) != KERN_SUCCESS) {
 		fputs("Failed to add device notification.", stderr);
 		stop_io_notifications(state);
-		devices_cleanup(state->devices);
+		devices_cleanup(&state->devices);
+		pthread_mutex_unlock(&devices_lock);
 		return;
 	}
+	pthread_mutex_unlock(&devices_lock);
+	// Restarts the run loop, and with it the tap, when it stops beating.
+	watchdog_start(stop_run_loop, state);
 
 	for (;;) {
-		if (listen_click_loop(state) != 0) {
-			devices_cleanup(state->devices);
+		if (listen_click_loop(state) != 0 || atomic_load(&click_loop_stopped)) {
+			pthread_mutex_lock(&devices_lock);
 			stop_io_notifications(state);
+			devices_cleanup(&state->devices);
+			pthread_mutex_unlock(&devices_lock);
+			return;
+		}
+		if (handoff_requested()) {
+			hand_off(state);
 			return;
 		}
 	}
 }
 
+bool handed_off(void) {
+	return handoff_requested();
+}
+
+void stop_click_loop(struct fm_state *state) {
+	// The heartbeat timer goes away with the rest, that is no stall to recover from.
+	atomic_store(&click_loop_stopped, true);
+	watchdog_idle();
+	release_click_loop(state);
+	// Stopping mid middle click would leave apps with the button held, let go of it for the
+	// user where the cursor is now. After a handoff the successor owns the click.
+	if (!handed_off() && atomic_exchange(&is_middle_click, false)) {
+		CGEventRef cursor = CGEventCreate(NULL);
+		emit(EMIT_MIDDLE_UP, cursor != NULL ? CGEventGetLocation(cursor) : CGPointZero);
+		if (cursor != NULL) {
+			CFRelease(cursor);
+		}
+		emit_flush();
+	}
+}
+
 void state_cleanup(struct fm_state *state) {
+	pthread_mutex_lock(&devices_lock);
 	stop_io_notifications(state);
+	pthread_mutex_unlock(&devices_lock);
 	stop_click_loop(state);
-	devices_cleanup(state->devices);
+	pthread_mutex_lock(&devices_lock);
+	devices_cleanup(&state->devices);
+	pthread_mutex_unlock(&devices_lock);
+	handoff_close();
+	trace_close();
 }
 
 #ifdef STANDALONE
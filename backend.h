@@ -2,19 +2,23 @@
 
 #include "multitouch.h"
 
-struct mt_devices {
-	CFMutableArrayRef array;
-	CFIndex len;
-};
+struct mt_devices;
 
 struct fm_state {
-	struct mt_devices devices;
+	struct mt_devices *devices;
 	IONotificationPortRef port;
 	CFMachPortRef tap_event;
 	CFRunLoopSourceRef run_loop_src;
+	CFMachPortRef drag_tap;
+	CFRunLoopSourceRef drag_src;
+	CFRunLoopTimerRef stats_timer;
+	CFRunLoopTimerRef watchdog_timer;
+	CFRunLoopRef run_loop;
 };
 
 struct fm_state new_state();
 void run_click_loop(struct fm_state *state);
 void stop_click_loop(struct fm_state *state);
 void state_cleanup(struct fm_state *state);
+// Whether run_click_loop returned because a newer instance took over.
+bool handed_off(void);
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "budget.h"
+
+// Budget per stage run unless FASTMIDDLE_BUDGET sets one in microseconds.
+#ifndef BUDGET_US
+#define BUDGET_US 1000
+#endif
+// First cooldown after a trip and the longest one repeated trips can back off to.
+#ifndef BUDGET_COOLDOWN_MS
+#define BUDGET_COOLDOWN_MS 1000
+#endif
+#ifndef BUDGET_MAX_COOLDOWN_MS
+#define BUDGET_MAX_COOLDOWN_MS 60000
+#endif
+// Runs within budget after which a stage is trusted again and the backoff starts over.
+#ifndef BUDGET_RECOVER
+#define BUDGET_RECOVER 100
+#endif
+
+uint64_t budget_ns = BUDGET_US * 1000ull;
+struct budget budgets[BUDGET_STAGES];
+
+static const char *stage_names[BUDGET_STAGES] = {"trace-click", "trace-frame", "grip"};
+
+#ifdef BUDGET_FAULTS
+_Atomic uint64_t budget_faults[BUDGET_STAGES];
+
+void budget_fault(enum budget_stage stage) {
+	uint64_t ns = atomic_load_explicit(&budget_faults[stage], memory_order_relaxed);
+
+	if (ns > 0) {
+		nanosleep(&(struct timespec) {ns / 1000000000, ns % 1000000000}, NULL);
+	}
+}
+#endif
+
+void budget_init(void) {
+	const char *env = getenv("FASTMIDDLE_BUDGET");
+
+	if (env != NULL && atof(env) > 0) {
+		budget_ns = (uint64_t)(atof(env) * 1000);
+	}
+}
+
+void budget_trip(enum budget_stage stage, uint64_t now) {
+	struct budget *b = &budgets[stage];
+	uint64_t cooldown = atomic_load_explicit(&b->cooldown, memory_order_relaxed);
+
+	cooldown = cooldown == 0 ? BUDGET_COOLDOWN_MS * 1000000ull : cooldown * 2;
+	if (cooldown > BUDGET_MAX_COOLDOWN_MS * 1000000ull) {
+		cooldown = BUDGET_MAX_COOLDOWN_MS * 1000000ull;
+	}
+	atomic_store_explicit(&b->cooldown, cooldown, memory_order_relaxed);
+	atomic_store_explicit(&b->streak, 0, memory_order_relaxed);
+	atomic_store_explicit(&b->disabled_until, now + cooldown, memory_order_relaxed);
+	atomic_fetch_add_explicit(&b->trips, 1, memory_order_relaxed);
+}
+
+void budget_recover(enum budget_stage stage) {
+	struct budget *b = &budgets[stage];
+
+	if (atomic_fetch_add_explicit(&b->streak, 1, memory_order_relaxed) + 1 == BUDGET_RECOVER) {
+		atomic_store_explicit(&b->cooldown, 0, memory_order_relaxed);
+		atomic_store_explicit(&b->disabled_until, 0, memory_order_relaxed);
+	}
+}
+
+void budget_report(FILE *f) {
+	for (int i = 0; i < BUDGET_STAGES; i++) {
+		struct budget *b = &budgets[i];
+		uint64_t trips = atomic_load_explicit(&b->trips, memory_order_relaxed);
+		if (trips == 0) {
+			continue;
+		}
+		fprintf(f, "  budget %-11s %llu trips, %llu runs skipped%s\n", stage_names[i],
+			(unsigned long long)trips,
+			(unsigned long long)atomic_load_explicit(&b->skipped, memory_order_relaxed),
+			atomic_load_explicit(&b->cooldown, memory_order_relaxed) != 0 ? ", on probation" : "");
+	}
+	fflush(f);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Optional work on the tap and frame paths. A stage that runs over budget is skipped for
+// a cooldown, doubled every time it trips again before it has recovered.
+enum budget_stage {
+	BUDGET_TRACE_CLICK, // recording clicks, on the tap
+	BUDGET_TRACE_FRAME, // recording frames
+	BUDGET_GRIP,        // Magic Mouse grip model, the plain finger count decides without it
+	BUDGET_STAGES
+};
+
+struct budget {
+	_Atomic uint64_t disabled_until; // ns on CLOCK_MONOTONIC, 0 while enabled
+	_Atomic uint64_t cooldown;       // ns, 0 once recovered
+	_Atomic uint32_t streak;         // runs within budget since the last trip
+	_Atomic uint64_t trips;
+	_Atomic uint64_t skipped;
+};
+
+extern uint64_t budget_ns;
+extern struct budget budgets[BUDGET_STAGES];
+
+// Check builds can hold a stage up for a while on every run, to make it trip on purpose.
+#ifdef BUDGET_FAULTS
+extern _Atomic uint64_t budget_faults[BUDGET_STAGES]; // ns per run
+void budget_fault(enum budget_stage stage);
+#else
+static inline void budget_fault(enum budget_stage stage) {}
+#endif
+
+void budget_init(void);
+void budget_trip(enum budget_stage stage, uint64_t now);
+void budget_recover(enum budget_stage stage);
+void budget_report(FILE *f);
+
+// Whether the stage may run at now, counting it as skipped if not.
+static inline bool budget_allow(enum budget_stage stage, uint64_t now) {
+	struct budget *b = &budgets[stage];
+	uint64_t until = atomic_load_explicit(&b->disabled_until, memory_order_relaxed);
+
+	if (until == 0 || now >= until) {
+		return true;
+	}
+	atomic_fetch_add_explicit(&b->skipped, 1, memory_order_relaxed);
+	return false;
+}
+
+// Charges a run of the stage from start to end against the budget.
+static inline void budget_charge(enum budget_stage stage, uint64_t start, uint64_t end) {
+	struct budget *b = &budgets[stage];
+
+	if (end - start > budget_ns) {
+		budget_trip(stage, end);
+	} else if (atomic_load_explicit(&b->cooldown, memory_order_relaxed) != 0) {
+		budget_recover(stage);
+	}
+}
@@ -0,0 +1,23 @@
+#include <stdio.h>
+
+#include "classify.h"
+
+bool classify_enabled = false;
+struct classify_model classify_model;
+
+bool classify_load(const char *path) {
+	struct classify_model m;
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fread(&m, sizeof(m), 1, f) == 1 && m.magic == CLASSIFY_MAGIC && m.version == CLASSIFY_VERSION
+		&& m.features == CLASSIFY_FEATURES;
+	fclose(f);
+	if (ok) {
+		classify_model = m;
+		classify_enabled = true;
+	}
+	return ok;
+}
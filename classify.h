@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "decode.h"
+
+/*
+ * Learned alternative to the three finger rule on trackpads: a logistic regression over a
+ * few features of the contacts on the surface, evaluated in fixed point. Features and
+ * weights are Q16, their products and the bias Q32. It runs on every frame that changes,
+ * like the rule it replaces, so a click still only loads the published decision, and it
+ * costs one pass over at most MAX_CONTACTS contacts and CLASSIFY_FEATURES multiplies.
+ *
+ * fmtrace --train fits it to recorded traces and writes the model, FASTMIDDLE_MODEL loads it.
+ * The model is stored in the byte order of the machine that trained it.
+ */
+
+#define CLASSIFY_MAGIC 0x314d4d46 // "FMM1"
+#define CLASSIFY_VERSION 1
+#define CLASSIFY_ONE (1 << 16)
+// Weights beyond this many units are clamped when training, so no sum can overflow.
+#define CLASSIFY_MAX_WEIGHT 256
+
+enum classify_feature {
+	CLASSIFY_TOUCHING,  // contacts pressing on the surface
+	CLASSIFY_THREE,     // 1 with exactly three of them, the built-in rule
+	CLASSIFY_OTHERS,    // contacts hovering or lifting off
+	CLASSIFY_SPREAD_X,  // width and height of the box around the pressing ones
+	CLASSIFY_SPREAD_Y,
+	CLASSIFY_LOWEST,    // y of the lowest one, resting thumbs sit at the bottom
+	CLASSIFY_LARGEST,   // size of the largest one, palms are large
+	CLASSIFY_MEAN_SIZE,
+	CLASSIFY_FEATURES
+};
+
+struct classify_model {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t features; // CLASSIFY_FEATURES of the build that trained it
+	int32_t weights[CLASSIFY_FEATURES];
+	int64_t bias;
+};
+
+// Set by classify_load once FASTMIDDLE_MODEL names a usable model.
+extern bool classify_enabled;
+extern struct classify_model classify_model;
+
+bool classify_load(const char *path);
+
+static inline int32_t classify_fixed(float v) {
+	// Sizes are a handful of units, anything past 16 is as large as it gets.
+	return (int32_t)((v < 0 ? 0 : v < 16 ? v : 16) * CLASSIFY_ONE);
+}
+
+static inline void classify_features(const struct contact *contacts, int n, int32_t f[CLASSIFY_FEATURES]) {
+	int32_t min_x = CLASSIFY_ONE, max_x = 0, min_y = CLASSIFY_ONE, max_y = 0, largest = 0, sizes = 0;
+	int touching = 0;
+
+	n = n < MAX_CONTACTS ? n : MAX_CONTACTS;
+	for (int i = 0; i < n; i++) {
+		const struct contact *c = &contacts[i];
+		if (c->state != STATE_MAKE_TOUCH && c->state != STATE_TOUCHING) {
+			continue;
+		}
+		int32_t x = classify_fixed(c->x), y = classify_fixed(c->y), size = classify_fixed(c->size);
+		min_x = x < min_x ? x : min_x;
+		max_x = x > max_x ? x : max_x;
+		min_y = y < min_y ? y : min_y;
+		max_y = y > max_y ? y : max_y;
+		largest = size > largest ? size : largest;
+		sizes += size;
+		touching++;
+	}
+	f[CLASSIFY_TOUCHING] = touching * CLASSIFY_ONE;
+	f[CLASSIFY_THREE] = touching == 3 ? CLASSIFY_ONE : 0;
+	f[CLASSIFY_OTHERS] = (n - touching) * CLASSIFY_ONE;
+	f[CLASSIFY_SPREAD_X] = touching > 0 ? max_x - min_x : 0;
+	f[CLASSIFY_SPREAD_Y] = touching > 0 ? max_y - min_y : 0;
+	f[CLASSIFY_LOWEST] = touching > 0 ? min_y : 0;
+	f[CLASSIFY_LARGEST] = largest;
+	f[CLASSIFY_MEAN_SIZE] = touching > 0 ? sizes / touching : 0;
+}
+
+// Whether pressing now with these contacts on the surface is meant as a middle click.
+static inline bool classify(const struct classify_model *m, const struct contact *contacts, int n) {
+	int32_t f[CLASSIFY_FEATURES];
+	int64_t score = m->bias;
+
+	classify_features(contacts, n, f);
+	for (int i = 0; i < CLASSIFY_FEATURES; i++) {
+		score += (int64_t)m->weights[i] * f[i];
+	}
+	return score > 0;
+}
@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "multitouch.h"
+#include "decode.h"
+
+// Frames with contacts that have to look sane before the layout in multitouch.h is trusted.
+#define PROBE_FRAMES 8
+// Highest contact state MultitouchSupport is known to report.
+#define MAX_STATE 7
+// Slack around the [0, 1] range of normalized coordinates.
+#define POS_SLACK 0.05f
+
+static int decode_probe(const void *raw, int nFingers, int frame, double timestamp, struct contact *out, int max);
+
+frame_decoder _Atomic decode_frame = decode_probe;
+
+static _Atomic int probed_frames = 0;
+
+// Decoder for the layout of struct finger in multitouch.h.
+static int decode_finger(const void *raw, int nFingers, int frame, double timestamp, struct contact *out, int max) {
+	const struct finger *fingers = raw;
+	int n = nFingers < max ? nFingers : max;
+
+	for (int i = 0; i < n; i++) {
+		out[i] = (struct contact) {
+			.identifier = fingers[i].identifier,
+			.state = fingers[i].state,
+			.x = fingers[i].normalized.pos.x,
+			.y = fingers[i].normalized.pos.y,
+			.size = fingers[i].size
+		};
+	}
+	return n;
+}
+
+// Fallback for a layout we don't recognize. Only the finger count can be trusted, so it
+// reports neutral touching contacts in the middle of the surface and every later stage
+// degrades to the plain finger count rule.
+static int decode_count(const void *raw, int nFingers, int frame, double timestamp, struct contact *out, int max) {
+	int n = nFingers < max ? nFingers : max;
+
+	for (int i = 0; i < n; i++) {
+		out[i] = (struct contact) {
+			.identifier = i,
+			.state = STATE_TOUCHING,
+			.x = 0.5f,
+			.y = 0.5f,
+			.size = 0
+		};
+	}
+	return n;
+}
+
+static inline bool in_range(float v) {
+	return v >= -POS_SLACK && v <= 1 + POS_SLACK;
+}
+
+// Every contact repeats the frame number and timestamp of the callback, so reading them back
+// at each offset checks the stride along with the field offsets.
+static inline bool finger_plausible(const struct finger *f, int frame, double timestamp) {
+	return f->frame == frame
+		&& f->timestamp == timestamp
+		&& f->state >= 0 && f->state <= MAX_STATE
+		&& in_range(f->normalized.pos.x) && in_range(f->normalized.pos.y)
+		&& f->size >= 0;
+}
+
+static int decode_probe(const void *raw, int nFingers, int frame, double timestamp, struct contact *out, int max) {
+	const struct finger *fingers = raw;
+
+	for (int i = 0; i < nFingers; i++) {
+		if (!finger_plausible(&fingers[i], frame, timestamp)) {
+			fputs("Unknown multitouch contact layout, falling back to finger count only.\n", stderr);
+			atomic_store(&decode_frame, decode_count);
+			return decode_count(raw, nFingers, frame, timestamp, out, max);
+		}
+	}
+	if (nFingers > 0 && atomic_fetch_add(&probed_frames, 1) + 1 == PROBE_FRAMES) {
+		atomic_store(&decode_frame, decode_finger);
+	}
+	return decode_finger(raw, nFingers, frame, timestamp, out, max);
+}
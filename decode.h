@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdatomic.h>
+
+// Contacts beyond this are not decoded, only counted.
+#define MAX_CONTACTS 16
+
+// MultitouchSupport contact states for a finger pressing on the surface.
+#define STATE_MAKE_TOUCH 4
+#define STATE_TOUCHING 5
+
+// Contact fields the gesture logic uses, independent of the layout MultitouchSupport hands over.
+struct contact {
+	int identifier;
+	int state;
+	float x;    // normalized position
+	float y;
+	float size;
+};
+
+// Decodes at most max of the nFingers raw contacts into out and returns how many were decoded.
+typedef int (*frame_decoder)(const void *raw, int nFingers, int frame, double timestamp, struct contact *out, int max);
+
+// Starts out probing the layout of the first frames and then switches itself to the decoder
+// matching it, so the steady state is a single indirect call to a fixed-layout decode.
+extern frame_decoder _Atomic decode_frame;
@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "emit.h"
+#include "stats.h"
+
+/*
+ * Synthesized events are posted from a thread of their own, so neither the tap nor the
+ * frame callbacks ever wait on the window server. Callers queue a kind and a location,
+ * the thread patches them into the kind's template along with a fresh timestamp and
+ * posts it. CGEventPost copies the event, so the templates are reused as they are.
+ */
+
+// Pending events beyond this are dropped rather than queued behind a stuck window server.
+#define EMIT_QUEUE 64
+
+struct emission {
+	enum emit_kind kind;
+	CGPoint location;
+	uint64_t queued; // ns on CLOCK_MONOTONIC
+};
+
+static CGEventRef templates[EMIT_KINDS];
+static struct emission queue[EMIT_QUEUE];
+static unsigned head;
+static unsigned tail;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t drained = PTHREAD_COND_INITIALIZER;
+static bool posting;
+
+// Cost of posting, and of waiting in the queue before that. Updated under lock.
+static uint64_t posted;
+static uint64_t dropped;
+static uint64_t post_ns;
+static uint64_t max_post_ns;
+static uint64_t wait_ns;
+
+static inline CGEventTimestamp event_time() {
+#ifdef __APPLE__
+	// The HID system stamps events in mach absolute time.
+	return mach_absolute_time();
+#else
+	return stats_clock(CLOCK_MONOTONIC);
+#endif
+}
+
+static void *emit_run(void *arg) {
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (head == tail) {
+			pthread_cond_wait(&queued, &lock);
+		}
+		struct emission e = queue[tail++ % EMIT_QUEUE];
+		posting = true;
+		pthread_mutex_unlock(&lock);
+
+		uint64_t start = stats_clock(CLOCK_MONOTONIC);
+		CGEventRef event = templates[e.kind];
+		CGEventSetLocation(event, e.location);
+		CGEventSetTimestamp(event, event_time());
+		CGEventPost(kCGHIDEventTap, event);
+		uint64_t end = stats_clock(CLOCK_MONOTONIC);
+
+		pthread_mutex_lock(&lock);
+		posting = false;
+		posted++;
+		post_ns += end - start;
+		max_post_ns = end - start > max_post_ns ? end - start : max_post_ns;
+		wait_ns += start - e.queued;
+		if (head == tail) {
+			pthread_cond_broadcast(&drained);
+		}
+	}
+	return NULL;
+}
+
+bool emit_init(void) {
+	static const CGEventType types[EMIT_KINDS] = {
+		[EMIT_MIDDLE_DOWN] = kCGEventOtherMouseDown,
+		[EMIT_MIDDLE_UP] = kCGEventOtherMouseUp,
+	};
+	pthread_t thread;
+
+	for (int i = 0; i < EMIT_KINDS; i++) {
+		templates[i] = CGEventCreateMouseEvent(NULL, types[i], CGPointZero, kCGMouseButtonCenter);
+		if (templates[i] == NULL) {
+			fputs("Failed to create event templates.\n", stderr);
+			return false;
+		}
+		CGEventSetIntegerValueField(templates[i], kCGMouseEventClickState, 1);
+	}
+	if (pthread_create(&thread, NULL, emit_run, NULL) != 0) {
+		fputs("Failed to start the event emitter.\n", stderr);
+		for (int i = 0; i < EMIT_KINDS; i++) {
+			CFRelease(templates[i]);
+			templates[i] = NULL;
+		}
+		return false;
+	}
+	pthread_detach(thread);
+	return true;
+}
+
+bool emit(enum emit_kind kind, CGPoint location) {
+	uint64_t now = stats_clock(CLOCK_MONOTONIC);
+	bool ok;
+
+	pthread_mutex_lock(&lock);
+	ok = templates[kind] != NULL && head - tail < EMIT_QUEUE;
+	if (ok) {
+		queue[head++ % EMIT_QUEUE] = (struct emission) {kind, location, now};
+		pthread_cond_signal(&queued);
+	} else {
+		dropped++;
+	}
+	pthread_mutex_unlock(&lock);
+	return ok;
+}
+
+void emit_flush(void) {
+	pthread_mutex_lock(&lock);
+	while (templates[0] != NULL && (head != tail || posting)) {
+		pthread_cond_wait(&drained, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void emit_report(FILE *f) {
+	pthread_mutex_lock(&lock);
+	if (posted > 0 || dropped > 0) {
+		fprintf(f, "  emit   %llu posted, %llu dropped, %llu ns/post (max %llu), %llu ns queued\n",
+			(unsigned long long)posted, (unsigned long long)dropped,
+			(unsigned long long)(posted > 0 ? post_ns / posted : 0), (unsigned long long)max_post_ns,
+			(unsigned long long)(posted > 0 ? wait_ns / posted : 0));
+	}
+	pthread_mutex_unlock(&lock);
+	fflush(f);
+}
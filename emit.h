@@ -0,0 +1,19 @@
+#pragma once
+
+#include <ApplicationServices/ApplicationServices.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Events we synthesize. Each kind is posted from a template built once and patched.
+enum emit_kind {
+	EMIT_MIDDLE_DOWN,
+	EMIT_MIDDLE_UP,
+	EMIT_KINDS
+};
+
+bool emit_init(void);
+// Queues an event for the emitter thread, false if the queue is full and it was dropped.
+bool emit(enum emit_kind kind, CGPoint location);
+// Waits until everything queued so far has been posted.
+void emit_flush(void);
+void emit_report(FILE *f);
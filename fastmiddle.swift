@@ -83,6 +83,11 @@ final class FastMiddle: ObservableObject {
 		runQueue?.async { [weak self] in
 			guard let self else { return }
 			run_click_loop(self.state)
+
+			// A newer instance took over the tap, make room for it.
+			if handed_off() {
+				DispatchQueue.main.async { NSApplication.shared.terminate(nil) }
+			}
 		}
 	}
 
@@ -0,0 +1,113 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "filter.h"
+#include "stats.h"
+
+bool filter_enabled = true;
+
+// Filtered contact samples and the delay they picked up, for the stats report. The delay of
+// a first order low-pass on a steadily moving contact is its time constant.
+static _Atomic uint64_t samples = 0;
+static _Atomic uint64_t lag_total = 0; // ns
+static _Atomic uint64_t lag_max = 0;   // ns
+
+void filter_init(void) {
+	const char *env = getenv("FASTMIDDLE_FILTER");
+	filter_enabled = env == NULL || atoi(env) != 0;
+}
+
+// Smoothing factor of a low-pass at cutoff Hz over dt seconds.
+static inline float alpha(float cutoff, float dt) {
+	float r = 2 * (float)M_PI * cutoff * dt;
+	return r / (r + 1);
+}
+
+static inline void account(float tau_sum, float tau_max, int n) {
+	uint64_t max = (uint64_t)(tau_max * 1e9f);
+	uint64_t seen = atomic_load_explicit(&lag_max, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&samples, n, memory_order_relaxed);
+	atomic_fetch_add_explicit(&lag_total, (uint64_t)(tau_sum * 1e9f), memory_order_relaxed);
+	while (max > seen && !atomic_compare_exchange_weak_explicit(&lag_max, &seen, max,
+		memory_order_relaxed, memory_order_relaxed));
+}
+
+void filter_frame(struct filter_state *f, const struct filter_params *p, double timestamp,
+	struct contact *contacts, int n) {
+	// Lanes past n stay zero and are filtered along, so the loop has a fixed trip count.
+	float x[MAX_CONTACTS] = {0}, y[MAX_CONTACTS] = {0}, px[MAX_CONTACTS] = {0}, py[MAX_CONTACTS] = {0};
+	float pdx[MAX_CONTACTS] = {0}, pdy[MAX_CONTACTS] = {0}, keep[MAX_CONTACTS] = {0};
+	float tau[MAX_CONTACTS];
+
+	// Frames are never older than the previous one, stale ones are dropped before this.
+	float dt = f->len != 0 ? (float)(timestamp - f->last) : 0;
+	float inv_dt = dt > 0 ? 1 / dt : 0;
+	float a_d = alpha(p->d_cutoff, dt);
+	float min_cutoff = p->min_cutoff, beta = p->beta;
+
+	// Gather the previous state of every contact by identifier, so the filter itself runs
+	// over contiguous arrays.
+	for (int i = 0; i < n; i++) {
+		x[i] = contacts[i].x;
+		y[i] = contacts[i].y;
+		// A contact that wasn't there in the previous frame starts out at rest where it is.
+		for (int j = 0; j < f->len; j++) {
+			if (f->ids[j] == contacts[i].identifier) {
+				px[i] = f->x[j];
+				py[i] = f->y[j];
+				pdx[i] = f->dx[j];
+				pdy[i] = f->dy[j];
+				keep[i] = dt > 0;
+				break;
+			}
+		}
+	}
+
+	// Branch free across contacts so it vectorizes, each axis filtered on its own.
+	for (int i = 0; i < MAX_CONTACTS; i++) {
+		float dx = pdx[i] + a_d * ((x[i] - px[i]) * inv_dt - pdx[i]);
+		float dy = pdy[i] + a_d * ((y[i] - py[i]) * inv_dt - pdy[i]);
+		float cx = min_cutoff + beta * fabsf(dx);
+		float cy = min_cutoff + beta * fabsf(dy);
+		float fx = px[i] + alpha(cx, dt) * (x[i] - px[i]);
+		float fy = py[i] + alpha(cy, dt) * (y[i] - py[i]);
+		x[i] += keep[i] * (fx - x[i]);
+		y[i] += keep[i] * (fy - y[i]);
+		pdx[i] = keep[i] * dx;
+		pdy[i] = keep[i] * dy;
+		tau[i] = keep[i] / (2 * (float)M_PI * (cx < cy ? cx : cy));
+	}
+
+	float tau_sum = 0, tau_max = 0;
+	int filtered = 0;
+	// The previous state was all gathered, it is replaced by this frame's in frame order.
+	for (int i = 0; i < n; i++) {
+		f->ids[i] = contacts[i].identifier;
+		f->x[i] = contacts[i].x = x[i];
+		f->y[i] = contacts[i].y = y[i];
+		f->dx[i] = pdx[i];
+		f->dy[i] = pdy[i];
+		filtered += keep[i] != 0;
+		tau_sum += tau[i];
+		tau_max = tau[i] > tau_max ? tau[i] : tau_max;
+	}
+	f->len = n;
+	f->last = timestamp;
+
+	if (stats_enabled && filtered > 0) {
+		account(tau_sum, tau_max, filtered);
+	}
+}
+
+void filter_report(FILE *f) {
+	uint64_t n = atomic_load_explicit(&samples, memory_order_relaxed);
+
+	if (n > 0) {
+		fprintf(f, "  filter  %llu contacts, added lag mean %.1fms max %.1fms\n", (unsigned long long)n,
+			atomic_load_explicit(&lag_total, memory_order_relaxed) / 1e6 / n,
+			atomic_load_explicit(&lag_max, memory_order_relaxed) / 1e6);
+	}
+	fflush(f);
+}
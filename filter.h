@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+/*
+ * One Euro filter over contact positions, applied before they are quantized so sensor
+ * jitter neither wakes the gesture logic nor shakes position based decisions. Each
+ * contact gets a low-pass whose cutoff rises with its smoothed speed: resting fingers
+ * are held steady and moving ones follow closely.
+ */
+
+struct filter_params {
+	float min_cutoff; // Hz, cutoff of a resting contact
+	float beta;       // cutoff added per surface width per second of speed
+	float d_cutoff;   // Hz, cutoff of the speed estimate
+};
+
+// Filtered position and speed of the contacts in the previous frame of a device, matched
+// to the next frame's contacts by their full identifier. Like the rest of a device slot it
+// is only written by that device's callbacks.
+struct filter_state {
+	double last; // timestamp of the previous frame
+	int len;     // contacts in it
+	int ids[MAX_CONTACTS];
+	float x[MAX_CONTACTS];
+	float y[MAX_CONTACTS];
+	float dx[MAX_CONTACTS];
+	float dy[MAX_CONTACTS];
+};
+
+// Cleared by filter_init when FASTMIDDLE_FILTER=0.
+extern bool filter_enabled;
+
+void filter_init(void);
+// Replaces the positions of the n contacts with their filtered ones.
+void filter_frame(struct filter_state *f, const struct filter_params *p, double timestamp,
+	struct contact *contacts, int n);
+void filter_report(FILE *f);
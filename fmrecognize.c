@@ -0,0 +1,196 @@
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recognize.h"
+
+/*
+ * Reference out-of-process recognizer, the starting point for experimental ones:
+ *
+ *   FASTMIDDLE_RECOGNIZER=/fastmiddle fastmiddle &
+ *   fmrecognize /fastmiddle
+ *
+ * It decides with the built-in trackpad rule, so clicks come out the same as without it
+ * on a trackpad, and reports every few seconds the round trip from the core publishing a
+ * click to its answer. Killing or stopping it only costs the core its deadline.
+ */
+
+// Histogram bucket i counts round trips in [2^(i-1), 2^i) microseconds, bucket 0 those below 1.
+#define HIST_BUCKETS 24
+// Clicks follow touches, so for a while after a frame the ring is polled every HOT_POLL_US
+// microseconds, then with a backoff doubling up to MAX_BACKOFF_US.
+#define HOT_WINDOW_MS 250
+#define HOT_POLL_US 10
+#define MAX_BACKOFF_US 1000
+#define REPORT_INTERVAL 5
+
+struct histogram {
+	uint64_t buckets[HIST_BUCKETS];
+	uint64_t n;
+	uint64_t max;
+};
+
+static volatile sig_atomic_t done = 0;
+
+static inline uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void hist_add(struct histogram *h, uint64_t ns) {
+	double us = ns / 1e3;
+	int i = us < 1 ? 0 : 1 + (int)log2(us);
+	h->buckets[i < HIST_BUCKETS ? i : HIST_BUCKETS - 1]++;
+	h->n++;
+	h->max = ns > h->max ? ns : h->max;
+}
+
+// Upper bound in microseconds of the bucket the q quantile falls in.
+static inline double hist_quantile(const struct histogram *h, double q) {
+	uint64_t rank = (uint64_t)ceil(q * h->n);
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank && seen > 0) {
+			return ldexp(1, i);
+		}
+	}
+	return 0;
+}
+
+// The built-in trackpad rule, three fingers on a device vote for a middle click.
+static inline uint64_t decide(uint64_t decision, const struct recognize_frame *f) {
+	uint64_t bit = UINT64_C(1) << (f->device & 63);
+	return f->fingers == 3 ? decision | bit : decision & ~bit;
+}
+
+static struct recognize_ring *attach(const char *name) {
+	struct stat st;
+	struct recognize_ring *ring;
+
+	for (;;) {
+		int fd = shm_open(name, O_RDWR, 0);
+		if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size == sizeof(*ring)) {
+			ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if (ring == MAP_FAILED) {
+				return NULL;
+			}
+			return ring;
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		// The core isn't up yet.
+		if (done) {
+			return NULL;
+		}
+		sleep(1);
+	}
+}
+
+static void report(const struct histogram *h, uint64_t frames, uint64_t lost) {
+	if (h->n == 0) {
+		printf("%llu frames, %llu lost, no clicks\n", (unsigned long long)frames, (unsigned long long)lost);
+	} else {
+		printf("%llu frames, %llu lost, %llu clicks answered in p50 <%.0fus p99 <%.0fus max %.1fus\n",
+			(unsigned long long)frames, (unsigned long long)lost, (unsigned long long)h->n,
+			hist_quantile(h, 0.5), hist_quantile(h, 0.99), h->max / 1e3);
+	}
+	fflush(stdout);
+}
+
+static void stop(int sig) {
+	done = 1;
+}
+
+int main(int argc, const char **argv) {
+	if (argc != 2) {
+		fputs("usage: fmrecognize /ring-name\n", stderr);
+		return 2;
+	}
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	struct recognize_ring *ring = attach(argv[1]);
+	if (ring == NULL) {
+		fprintf(stderr, "fmrecognize: cannot map %s\n", argv[1]);
+		return 1;
+	}
+
+	struct histogram roundtrip = {0};
+	struct recognize_frame f;
+	uint64_t frames = 0, lost = 0, decision = 0, ticket = 0;
+	uint64_t next_report = now_ns() + REPORT_INTERVAL * 1000000000ull;
+	uint64_t active = 0;
+	int32_t pid = 0;
+	useconds_t backoff = HOT_POLL_US;
+
+	while (!done) {
+		if (now_ns() >= next_report) {
+			report(&roundtrip, frames, lost);
+			next_report += REPORT_INTERVAL * 1000000000ull;
+		}
+		if (atomic_load_explicit(&ring->magic, memory_order_acquire) != RECOGNIZE_MAGIC
+			|| ring->version != RECOGNIZE_VERSION) {
+			usleep(MAX_BACKOFF_US);
+			continue;
+		}
+		if (ring->pid != pid) {
+			// A core that started after us cleared the ring and is owed everything it published,
+			// one that was there first only from now on.
+			ticket = pid == 0 ? atomic_load_explicit(&ring->head, memory_order_acquire) : 0;
+			pid = ring->pid;
+			decision = 0;
+		}
+
+		if (ticket == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+			if (now_ns() - active < HOT_WINDOW_MS * 1000000ull) {
+				backoff = HOT_POLL_US;
+			} else {
+				backoff = backoff < MAX_BACKOFF_US / 2 ? backoff * 2 : MAX_BACKOFF_US;
+			}
+			usleep(backoff);
+			continue;
+		}
+		struct recognize_frame *slot = &ring->frames[ticket % RECOGNIZE_SLOTS];
+		uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq < 2 * ticket + 2) {
+			// Claimed but still being written.
+			continue;
+		}
+		memcpy(&f, slot, sizeof(f));
+		atomic_thread_fence(memory_order_acquire);
+		if (seq != 2 * ticket + 2 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+			// The core lapped us, the frame is gone.
+			lost++;
+			atomic_store_explicit(&ring->answered, ++ticket, memory_order_release);
+			continue;
+		}
+		switch (f.kind) {
+		case RECOGNIZE_FRAME:
+			frames++;
+			active = now_ns();
+			decision = decide(decision, &f);
+			break;
+		case RECOGNIZE_RESET:
+			decision = 0;
+			break;
+		}
+		atomic_store_explicit(&ring->decision, decision, memory_order_relaxed);
+		atomic_store_explicit(&ring->answered, ++ticket, memory_order_release);
+		if (f.kind == RECOGNIZE_CLICK) {
+			hist_add(&roundtrip, now_ns() - atomic_load_explicit(&f.published, memory_order_relaxed));
+		}
+	}
+
+	report(&roundtrip, frames, lost);
+	return 0;
+}
@@ -0,0 +1,924 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "classify.h"
+#include "trace.h"
+
+/*
+ * Single pass analytics over recorded traces, to tune the gesture defaults:
+ *
+ *   fmtrace session1.fmt session2.fmt ...
+ *
+ * Files are spread over one thread per core and every thread folds its files into its
+ * own accumulator, merged at the end. Distributions are kept as fixed log2 histograms
+ * over microseconds instead of the samples themselves, so memory does not grow with
+ * the length or number of traces.
+ *
+ * A trace can also be turned into a shim script with the clicks as recorded for its
+ * expected output, to replay it through other builds of the gesture logic:
+ *
+ *   fmtrace --script session.fmt session    writes session.txt and session.out
+ *
+ * and the codec measured on a synthetic session of the given number of frames:
+ *
+ *   fmtrace --bench [frames]
+ *
+ * which also times seeking into it, as it does for a trace of one's own given instead.
+ * Any trace can be read from a point on, a time in seconds or a click number:
+ *
+ *   fmtrace --seek 1234.5 session.fmt
+ *   fmtrace --seek '#17' session.fmt
+ *
+ * and the click model FASTMIDDLE_MODEL loads fitted to traces:
+ *
+ *   fmtrace --train model.fmm session1.fmt session2.fmt ...
+ */
+
+// Histogram bucket i counts values in [2^(i-1), 2^i) microseconds, bucket 0 those below 1.
+#define HIST_BUCKETS 40
+// Fingers landing further apart than this are separate landings.
+#define LANDING_WINDOW 0.1
+// A click this close to a finger count change may have been decided on the wrong count.
+#define MISFIRE_WINDOW 0.05
+// Frames --bench records unless told otherwise, and what each contact of them would take
+// as a raw struct finger dump.
+#define BENCH_FRAMES 200000
+#define BENCH_RAW_CONTACT 96
+// Random seeks through the index and scans from the start --bench times, and the events
+// --seek prints.
+#define BENCH_SEEKS 10000
+#define BENCH_SCANS 20
+#define SEEK_EVENTS 20
+// Full batch gradient descent steps and their rate, over standardized features.
+#define TRAIN_STEPS 2000
+#define TRAIN_RATE 0.5
+// Evaluations --train times the model over.
+#define TRAIN_EVALUATIONS 10000000
+// Rows of the per-device table, kinds of device and slots of traces that don't record theirs.
+#define DEVICE_ROWS (2 * TRACE_MAX_DEVICES)
+
+struct histogram {
+	uint64_t buckets[HIST_BUCKETS];
+	uint64_t n;
+};
+
+// Devices are told apart by the identity their traces record, so the same kind of device
+// lands in one row whatever slot it had in whichever file. Traces that predate device
+// records only have the slot to go by.
+struct device_analysis {
+	bool identified;
+	struct trace_device profile;
+	int slot; // unidentified devices only
+	uint64_t frames;
+	struct histogram interval;
+	// Welford running mean and squared deviation of the frame interval in seconds.
+	double mean;
+	double m2;
+};
+
+struct analysis {
+	uint64_t files;
+	uint64_t errors;
+	uint64_t frames;
+	uint64_t clicks;
+	uint64_t middle_clicks;
+	// Finger count of a device's frame by the count of its previous one.
+	uint64_t transitions[MAX_CONTACTS + 1][MAX_CONTACTS + 1];
+	struct histogram landing;
+	struct histogram click_offset;
+	uint64_t misfire_middle;
+	uint64_t misfire_left;
+	// Frames of devices that found the table full.
+	uint64_t unlisted_frames;
+	int rows;
+	struct device_analysis devices[DEVICE_ROWS];
+};
+
+// Per file state, the analysis itself only ever accumulates.
+struct device_state {
+	// Where the slot's frames are counted, NULL when the table was full, once keyed by its
+	// first frame or device record.
+	struct device_analysis *row;
+	bool keyed;
+	bool seen;
+	int count;
+	double last;
+	double changed;
+	// Landing in progress: first arrival, latest arrival and most fingers so far.
+	double landing_start;
+	double landing_last;
+	int landing_peak;
+};
+
+static const char **paths;
+static int npaths;
+static _Atomic int next_path = 0;
+
+static inline void hist_add(struct histogram *h, double seconds) {
+	double us = seconds * 1e6;
+	int i = us < 1 ? 0 : 1 + (int)log2(us);
+	h->buckets[i < HIST_BUCKETS ? i : HIST_BUCKETS - 1]++;
+	h->n++;
+}
+
+static inline void hist_merge(struct histogram *dst, const struct histogram *src) {
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->n += src->n;
+}
+
+// Upper bound in milliseconds of the bucket the q quantile falls in.
+static inline double hist_quantile(const struct histogram *h, double q) {
+	uint64_t rank = (uint64_t)ceil(q * h->n);
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank && seen > 0) {
+			return ldexp(1, i) / 1e3;
+		}
+	}
+	return 0;
+}
+
+static inline void landing_end(struct analysis *a, struct device_state *d) {
+	if (d->landing_peak >= 2) {
+		hist_add(&a->landing, d->landing_last - d->landing_start);
+	}
+	d->landing_peak = 0;
+}
+
+static inline bool same_row(const struct device_analysis *row, const struct device_analysis *key) {
+	if (row->identified != key->identified) {
+		return false;
+	}
+	if (!key->identified) {
+		return row->slot == key->slot;
+	}
+	return row->profile.family == key->profile.family && row->profile.product == key->profile.product
+		&& row->profile.builtin == key->profile.builtin;
+}
+
+// Returns the row for the key, adding it if it is new, or NULL once the table is full.
+static struct device_analysis *device_row(struct analysis *a, const struct device_analysis *key) {
+	for (int i = 0; i < a->rows; i++) {
+		if (same_row(&a->devices[i], key)) {
+			return &a->devices[i];
+		}
+	}
+	if (a->rows == DEVICE_ROWS) {
+		return NULL;
+	}
+	struct device_analysis *row = &a->devices[a->rows++];
+	*row = (struct device_analysis) {.identified = key->identified, .profile = key->profile, .slot = key->slot};
+	return row;
+}
+
+static inline void analyze_frame(struct analysis *a, struct device_state *d, const struct trace_event *ev) {
+	int count = ev->len;
+
+	if (!d->keyed) {
+		d->row = device_row(a, &(struct device_analysis) {.slot = ev->device});
+		d->keyed = true;
+	}
+	struct device_analysis *da = d->row;
+	if (da == NULL) {
+		a->unlisted_frames++;
+	} else {
+		if (d->seen) {
+			double dt = ev->timestamp - d->last;
+			hist_add(&da->interval, dt);
+			double delta = dt - da->mean;
+			da->mean += delta / da->interval.n;
+			da->m2 += delta * (dt - da->mean);
+		}
+		da->frames++;
+	}
+	d->seen = true;
+	d->last = ev->timestamp;
+	a->frames++;
+	a->transitions[d->count][count]++;
+
+	if (d->landing_peak > 0 && ev->timestamp - d->landing_start > LANDING_WINDOW) {
+		landing_end(a, d);
+	}
+	if (count > d->count) {
+		if (d->count == 0) {
+			landing_end(a, d);
+			d->landing_start = ev->timestamp;
+		}
+		if (d->count == 0 || d->landing_peak > 0) {
+			d->landing_last = ev->timestamp;
+			d->landing_peak = count;
+		}
+	} else if (count < d->count) {
+		landing_end(a, d);
+	}
+
+	if (count != d->count) {
+		d->changed = ev->timestamp;
+		d->count = count;
+	}
+}
+
+static void analyze_file(struct analysis *a, const char *path) {
+	struct trace_file f;
+	struct trace_reader r;
+	struct trace_event ev;
+	struct device_state devices[TRACE_MAX_DEVICES] = {0};
+	double last_frame = -1;
+	double pending_left = -1;
+
+	if (!trace_map(&f, path) || !trace_reader_init(&r, f.data, f.len)) {
+		fprintf(stderr, "fmtrace: cannot read %s\n", path);
+		a->errors++;
+		return;
+	}
+
+	enum trace_kind kind;
+	while ((kind = trace_next(&r, &ev)) != TRACE_END && kind != TRACE_ERROR) {
+		if (kind == TRACE_FRAME) {
+			struct device_state *d = &devices[ev.device];
+			analyze_frame(a, d, &ev);
+			last_frame = ev.timestamp;
+			// A plain click right before three fingers landed.
+			if (pending_left >= 0 && d->count == 3 && ev.timestamp - pending_left < MISFIRE_WINDOW) {
+				a->misfire_left++;
+				pending_left = -1;
+			}
+			continue;
+		}
+		if (kind == TRACE_DEVICE) {
+			// Another device in the slot from here on, nothing carries over from the last one.
+			struct device_state *d = &devices[ev.device];
+			landing_end(a, d);
+			*d = (struct device_state) {
+				.row = device_row(a, &(struct device_analysis) {.identified = true, .profile = ev.profile}),
+				.keyed = true
+			};
+			continue;
+		}
+
+		if (!ev.down) {
+			continue;
+		}
+		a->clicks++;
+		if (last_frame >= 0) {
+			hist_add(&a->click_offset, ev.timestamp - last_frame);
+		}
+		if (ev.middle) {
+			a->middle_clicks++;
+			// A middle click decided on a count that had only just settled.
+			for (int i = 0; i < TRACE_MAX_DEVICES; i++) {
+				if (devices[i].count == 3 && ev.timestamp - devices[i].changed < MISFIRE_WINDOW) {
+					a->misfire_middle++;
+					break;
+				}
+			}
+		} else {
+			pending_left = ev.timestamp;
+		}
+	}
+
+	if (kind == TRACE_ERROR) {
+		fprintf(stderr, "fmtrace: %s is truncated or corrupt, analyzed up to the damage\n", path);
+		a->errors++;
+	}
+	a->files++;
+	trace_unmap(&f);
+}
+
+static void *worker(void *arg) {
+	struct analysis *a = arg;
+	for (int i; (i = atomic_fetch_add(&next_path, 1)) < npaths;) {
+		analyze_file(a, paths[i]);
+	}
+	return NULL;
+}
+
+static void merge(struct analysis *dst, const struct analysis *src) {
+	dst->files += src->files;
+	dst->errors += src->errors;
+	dst->frames += src->frames;
+	dst->clicks += src->clicks;
+	dst->middle_clicks += src->middle_clicks;
+	dst->misfire_middle += src->misfire_middle;
+	dst->misfire_left += src->misfire_left;
+	dst->unlisted_frames += src->unlisted_frames;
+	for (int i = 0; i <= MAX_CONTACTS; i++) {
+		for (int j = 0; j <= MAX_CONTACTS; j++) {
+			dst->transitions[i][j] += src->transitions[i][j];
+		}
+	}
+	hist_merge(&dst->landing, &src->landing);
+	hist_merge(&dst->click_offset, &src->click_offset);
+
+	for (int i = 0; i < src->rows; i++) {
+		const struct device_analysis *s = &src->devices[i];
+		struct device_analysis *d = device_row(dst, s);
+		if (d == NULL) {
+			dst->unlisted_frames += s->frames;
+			continue;
+		}
+		// Chan et al. pairwise combination of the running moments.
+		uint64_t n = d->interval.n + s->interval.n;
+		if (n > 0) {
+			double delta = s->mean - d->mean;
+			d->m2 += s->m2 + delta * delta * d->interval.n * s->interval.n / n;
+			d->mean += delta * s->interval.n / n;
+		}
+		d->frames += s->frames;
+		hist_merge(&d->interval, &s->interval);
+	}
+}
+
+static void print_histogram(const char *name, const struct histogram *h) {
+	if (h->n == 0) {
+		printf("%-14s none\n", name);
+		return;
+	}
+	printf("%-14s %8llu  p50 <%.3fms  p90 <%.3fms  p99 <%.3fms\n", name, (unsigned long long)h->n,
+		hist_quantile(h, 0.5), hist_quantile(h, 0.9), hist_quantile(h, 0.99));
+}
+
+// Identified devices by identity, then the slots of traces without device records.
+static int compare_rows(const void *a, const void *b) {
+	const struct device_analysis *x = *(const struct device_analysis *const *)a;
+	const struct device_analysis *y = *(const struct device_analysis *const *)b;
+
+	if (x->identified != y->identified) {
+		return y->identified - x->identified;
+	}
+	if (!x->identified) {
+		return x->slot - y->slot;
+	}
+	if (x->profile.family != y->profile.family) {
+		return x->profile.family < y->profile.family ? -1 : 1;
+	}
+	if (x->profile.product != y->profile.product) {
+		return x->profile.product < y->profile.product ? -1 : 1;
+	}
+	return x->profile.builtin - y->profile.builtin;
+}
+
+static void report(const struct analysis *a) {
+	int max = 0;
+	for (int i = 0; i <= MAX_CONTACTS; i++) {
+		for (int j = 0; j <= MAX_CONTACTS; j++) {
+			if (a->transitions[i][j] > 0) {
+				max = i > max ? i : max;
+				max = j > max ? j : max;
+			}
+		}
+	}
+
+	printf("%llu files, %llu frames, %llu clicks (%llu middle)\n", (unsigned long long)a->files,
+		(unsigned long long)a->frames, (unsigned long long)a->clicks, (unsigned long long)a->middle_clicks);
+
+	printf("\nfinger count transitions (rows from, columns to):\n    ");
+	for (int j = 0; j <= max; j++) {
+		printf(" %9d", j);
+	}
+	for (int i = 0; i <= max; i++) {
+		printf("\n%3d ", i);
+		for (int j = 0; j <= max; j++) {
+			printf(" %9llu", (unsigned long long)a->transitions[i][j]);
+		}
+	}
+	printf("\n\n");
+
+	print_histogram("landing jitter", &a->landing);
+	print_histogram("click offset", &a->click_offset);
+	// Rates are against the clicks decided each way, a click of the other kind can't have
+	// misfired like that.
+	uint64_t left_clicks = a->clicks - a->middle_clicks;
+	printf("misfire candidates: %llu of %llu middle clicks within %.0fms of a count change, "
+		"%.2f%% false positives\n", (unsigned long long)a->misfire_middle,
+		(unsigned long long)a->middle_clicks, MISFIRE_WINDOW * 1e3,
+		a->middle_clicks > 0 ? 100.0 * a->misfire_middle / a->middle_clicks : 0);
+	printf("                    %llu of %llu plain clicks followed by three fingers within %.0fms, "
+		"%.2f%% false negatives\n", (unsigned long long)a->misfire_left, (unsigned long long)left_clicks,
+		MISFIRE_WINDOW * 1e3, left_clicks > 0 ? 100.0 * a->misfire_left / left_clicks : 0);
+
+	const struct device_analysis *rows[DEVICE_ROWS];
+	for (int i = 0; i < a->rows; i++) {
+		rows[i] = &a->devices[i];
+	}
+	qsort(rows, a->rows, sizeof(*rows), compare_rows);
+	printf("\ndevice                          frames    mean ms  stddev ms  p50 ms  p99 ms\n");
+	for (int i = 0; i < a->rows; i++) {
+		const struct device_analysis *d = rows[i];
+		char name[64];
+		if (d->interval.n == 0) {
+			continue;
+		}
+		if (d->identified) {
+			snprintf(name, sizeof(name), "family %d product %d%s", d->profile.family, d->profile.product,
+				d->profile.builtin ? " builtin" : "");
+		} else {
+			snprintf(name, sizeof(name), "slot %d", d->slot);
+		}
+		double stddev = d->interval.n > 1 ? sqrt(d->m2 / (d->interval.n - 1)) : 0;
+		printf("%-26s %11llu %10.3f %10.3f %7.3f %7.3f\n", name, (unsigned long long)d->frames,
+			d->mean * 1e3, stddev * 1e3, hist_quantile(&d->interval, 0.5), hist_quantile(&d->interval, 0.99));
+	}
+	if (a->unlisted_frames > 0) {
+		printf("%llu frames of devices past the first %d left out\n", (unsigned long long)a->unlisted_frames,
+			DEVICE_ROWS);
+	}
+}
+
+static inline void print_contacts(FILE *f, const struct trace_event *ev) {
+	for (int i = 0; i < ev->len && i < MAX_CONTACTS; i++) {
+		const struct contact *c = &ev->contacts[i];
+		fprintf(f, " %.4f,%.4f,%.3f,%d,%d", c->x, c->y, c->size, c->state, c->identifier);
+	}
+	fputc('\n', f);
+}
+
+// Devices replay as what their slot first held, traces that predate device records have
+// every device replay as a trackpad unless its line is edited.
+static int write_script(const char *path, const char *name) {
+	struct trace_file f;
+	struct trace_reader r;
+	struct trace_event ev;
+	enum trace_kind kind;
+	char txt_path[4096], out_path[4096];
+	struct trace_device profiles[TRACE_MAX_DEVICES];
+	bool known[TRACE_MAX_DEVICES] = {false};
+	bool guessed = false;
+	int devices = 0;
+
+	if (!trace_map(&f, path)) {
+		fprintf(stderr, "fmtrace: cannot read %s\n", path);
+		return 1;
+	}
+	// The shim wants its devices before the first frame.
+	if (trace_reader_init(&r, f.data, f.len)) {
+		while ((kind = trace_next(&r, &ev)) != TRACE_END && kind != TRACE_ERROR) {
+			if (kind == TRACE_DEVICE && !known[ev.device]) {
+				profiles[ev.device] = ev.profile;
+				known[ev.device] = true;
+			}
+			if (kind == TRACE_FRAME && ev.device >= devices) {
+				devices = ev.device + 1;
+			}
+		}
+	}
+
+	snprintf(txt_path, sizeof(txt_path), "%s.txt", name);
+	snprintf(out_path, sizeof(out_path), "%s.out", name);
+	FILE *txt = fopen(txt_path, "w");
+	FILE *out = fopen(out_path, "w");
+	if (txt == NULL || out == NULL || !trace_reader_init(&r, f.data, f.len)) {
+		fprintf(stderr, "fmtrace: cannot write %s\n", txt == NULL ? txt_path : out_path);
+		if (txt != NULL) {
+			fclose(txt);
+		}
+		if (out != NULL) {
+			fclose(out);
+		}
+		trace_unmap(&f);
+		return 1;
+	}
+
+	for (int i = 0; i < devices; i++) {
+		guessed |= !known[i];
+	}
+	fprintf(txt, guessed ? "# replay of %s, Magic Mouse devices need their family set to 112\n"
+		: "# replay of %s\n", path);
+	for (int i = 0; i < devices; i++) {
+		if (known[i]) {
+			fprintf(txt, "device %d%s\n", profiles[i].family, profiles[i].builtin ? " builtin" : "");
+		} else {
+			fputs("device 0\n", txt);
+		}
+	}
+	while ((kind = trace_next(&r, &ev)) != TRACE_END && kind != TRACE_ERROR) {
+		if (kind == TRACE_FRAME) {
+			fprintf(txt, "frame %d %.6f", ev.device, ev.timestamp);
+			print_contacts(txt, &ev);
+			continue;
+		}
+		if (kind == TRACE_DEVICE) {
+			continue;
+		}
+		const char *button = ev.middle ? "other" : "left";
+		fputs(ev.down ? "down\n" : "up\n", txt);
+		fprintf(out, "left-%s -> %s-%s button %d\n", ev.down ? "down" : "up", button, ev.down ? "down" : "up",
+			ev.middle ? 2 : 0);
+	}
+	if (kind == TRACE_ERROR) {
+		fprintf(stderr, "fmtrace: %s is truncated or corrupt, converted up to the damage\n", path);
+	}
+	fclose(txt);
+	fclose(out);
+	trace_unmap(&f);
+	return kind == TRACE_ERROR;
+}
+
+static inline double now_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Two devices at 1 kHz each with three contacts circling, at rest a quarter of the time,
+// and a click every second. The recorder only has room for so many events until its writer
+// comes around, so the frames are fed at the pace it drains them.
+static void bench_record(long frames) {
+	struct contact contacts[3];
+
+	for (long i = 0; i < frames; i++) {
+		double t = 1 + i / 2000.0;
+		bool resting = i / 4000 % 4 == 3;
+		for (int c = 0; c < 3; c++) {
+			double a = (resting ? 0 : t) + c * 2.1;
+			contacts[c] = (struct contact) {
+				.identifier = c + 1,
+				.state = 4,
+				.x = 0.5f + 0.3f * (float)cos(a),
+				.y = 0.5f + 0.3f * (float)sin(a),
+				.size = 1 + 0.1f * c
+			};
+		}
+		trace_frame(i & 1, t, contacts, 3, 3 * BENCH_RAW_CONTACT);
+		if (i % 2000 == 0 || i % 2000 == 200) {
+			trace_click(t, i % 2000 == 0, i / 2000 % 2);
+		}
+		if (i % 256 == 255) {
+			nanosleep(&(struct timespec) {0, 5000000}, NULL);
+		}
+	}
+}
+
+// Times decoding the whole trace, and jumping into it through the index against scanning
+// up to the same places from the start.
+static int bench_read(const char *path) {
+	struct trace_file f;
+	struct trace_reader r;
+	struct trace_event ev;
+	enum trace_kind kind;
+	uint64_t events = 0, clicks = 0;
+	double first = -1, last = 0;
+
+	if (!trace_map(&f, path) || !trace_reader_init(&r, f.data, f.len)) {
+		fprintf(stderr, "fmtrace: cannot read %s\n", path);
+		trace_unmap(&f);
+		return 1;
+	}
+	double start = now_s();
+	while ((kind = trace_next(&r, &ev)) != TRACE_END && kind != TRACE_ERROR) {
+		events++;
+		clicks += kind == TRACE_CLICK;
+		first = first < 0 ? ev.timestamp : first;
+		last = ev.timestamp;
+	}
+	double s = now_s() - start;
+	printf("  decode %.0f MB/s of trace, %.1f M events/s\n", f.len / s / 1e6, events / s / 1e6);
+
+	srand(1);
+	start = now_s();
+	for (int i = 0; i < BENCH_SEEKS; i++) {
+		trace_seek_time(&r, &f, first + (last - first) * rand() / RAND_MAX, &ev);
+	}
+	double by_time = (now_s() - start) / BENCH_SEEKS;
+	start = now_s();
+	for (int i = 0; i < BENCH_SEEKS && clicks > 0; i++) {
+		trace_seek_click(&r, &f, (uint64_t)rand() % clicks, &ev);
+	}
+	double by_click = (now_s() - start) / BENCH_SEEKS;
+	start = now_s();
+	for (int i = 0; i < BENCH_SCANS; i++) {
+		double target = first + (last - first) * rand() / RAND_MAX;
+		trace_reader_init(&r, f.data, f.len);
+		while ((kind = trace_next(&r, &ev)) != TRACE_END && kind != TRACE_ERROR && ev.timestamp < target);
+	}
+	double scan = (now_s() - start) / BENCH_SCANS;
+	printf("  seek   %.1fus by time, %.1fus by click, %.1fus scanning from the start, %zu blocks\n",
+		by_time * 1e6, by_click * 1e6, scan * 1e6, f.blocks);
+
+	trace_unmap(&f);
+	return 0;
+}
+
+static int bench(long frames) {
+	char dir[] = "/tmp/fmtrace-bench-XXXXXX";
+	char path[64], index_path[sizeof(path) + 4];
+
+	if (mkdtemp(dir) == NULL) {
+		fputs("fmtrace: cannot create a directory for the bench\n", stderr);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/bench.fmt", dir);
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	if (!trace_open(path)) {
+		fprintf(stderr, "fmtrace: cannot write %s\n", path);
+		rmdir(dir);
+		return 1;
+	}
+	bench_record(frames);
+	trace_close();
+	printf("%ld frames recorded\n", frames);
+	trace_report(stdout);
+
+	int status = bench_read(path);
+	unlink(index_path);
+	unlink(path);
+	rmdir(dir);
+	return status;
+}
+
+// Prints SEEK_EVENTS events from the first at or after a time in seconds, or from a click
+// given by its 0-based number as #n.
+static int seek(const char *where, const char *path) {
+	struct trace_file f;
+	struct trace_reader r;
+	struct trace_event ev;
+
+	if (!trace_map(&f, path)) {
+		fprintf(stderr, "fmtrace: cannot read %s\n", path);
+		return 1;
+	}
+	if (f.blocks == 0) {
+		fprintf(stderr, "fmtrace: %s has no index, scanning from the start\n", path);
+	}
+	enum trace_kind kind = where[0] == '#'
+		? trace_seek_click(&r, &f, strtoull(where + 1, NULL, 10), &ev)
+		: trace_seek_time(&r, &f, atof(where), &ev);
+	for (int i = 0; i < SEEK_EVENTS && kind != TRACE_END && kind != TRACE_ERROR; i++) {
+		if (kind == TRACE_FRAME) {
+			printf("%.6f\tframe %d", ev.timestamp, ev.device);
+			print_contacts(stdout, &ev);
+		} else if (kind == TRACE_DEVICE) {
+			printf("%.6f\tdevice %d family %d product %d%s\n", ev.timestamp, ev.device, ev.profile.family,
+				ev.profile.product, ev.profile.builtin ? " builtin" : "");
+		} else {
+			printf("%.6f\t%s %s\n", ev.timestamp, ev.down ? "down" : "up", ev.middle ? "middle" : "left");
+		}
+		kind = trace_next(&r, &ev);
+	}
+	trace_unmap(&f);
+	if (kind == TRACE_ERROR) {
+		fprintf(stderr, "fmtrace: %s is truncated or corrupt\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+// A press and what it was meant as: the contacts of the device touched last, and whether the
+// click was turned into a middle click, or should have been.
+struct sample {
+	struct contact contacts[MAX_CONTACTS];
+	int len;
+	bool middle;
+};
+
+struct samples {
+	struct sample *v;
+	size_t len;
+	size_t cap;
+	uint64_t relabeled; // plain clicks followed by three fingers, taken as meant middle
+	uint64_t skipped;   // middle clicks on a count that had only just settled
+};
+
+static struct sample *sample_add(struct samples *s) {
+	if (s->len == s->cap) {
+		size_t cap = s->cap > 0 ? 2 * s->cap : 1024;
+		struct sample *v = realloc(s->v, cap * sizeof(*v));
+		if (v == NULL) {
+			return NULL;
+		}
+		s->v = v;
+		s->cap = cap;
+	}
+	return &s->v[s->len++];
+}
+
+// Labels are the decisions recorded, corrected where the misfire candidates of the analysis
+// point at them: a plain click right before three fingers landed was meant as a middle one,
+// and a middle click on a count that had only just settled is left out, what was meant is
+// anyone's guess.
+static bool collect(struct samples *s, const char *path) {
+	struct trace_file f;
+	struct trace_reader r;
+	struct trace_event ev;
+	struct trace_event *last = calloc(TRACE_MAX_DEVICES, sizeof(*last));
+	double changed[TRACE_MAX_DEVICES] = {0};
+	double pending_left = -1;
+	size_t pending = 0;
+	int latest = -1;
+	enum trace_kind kind = TRACE_END;
+
+	if (last == NULL || !trace_map(&f, path) || !trace_reader_init(&r, f.data, f.len)) {
+		fprintf(stderr, "fmtrace: cannot read %s\n", path);
+		free(last);
+		return false;
+	}
+	while ((kind = trace_next(&r, &ev)) != TRACE_END && kind != TRACE_ERROR) {
+		if (kind == TRACE_FRAME) {
+			if (ev.len != last[ev.device].len) {
+				changed[ev.device] = ev.timestamp;
+			}
+			last[ev.device] = ev;
+			latest = ev.device;
+			if (pending_left >= 0 && ev.len == 3 && ev.timestamp - pending_left < MISFIRE_WINDOW) {
+				s->v[pending].middle = true;
+				s->relabeled++;
+				pending_left = -1;
+			}
+			continue;
+		}
+		if (kind == TRACE_DEVICE) {
+			memset(&last[ev.device], 0, sizeof(last[ev.device]));
+			changed[ev.device] = 0;
+			continue;
+		}
+		if (!ev.down || latest < 0) {
+			continue;
+		}
+		if (ev.middle && last[latest].len == 3 && ev.timestamp - changed[latest] < MISFIRE_WINDOW) {
+			s->skipped++;
+			continue;
+		}
+		struct sample *sample = sample_add(s);
+		if (sample == NULL) {
+			fputs("fmtrace: out of memory\n", stderr);
+			break;
+		}
+		memcpy(sample->contacts, last[latest].contacts, sizeof(sample->contacts));
+		sample->len = last[latest].len;
+		sample->middle = ev.middle;
+		if (!ev.middle) {
+			pending_left = ev.timestamp;
+			pending = s->len - 1;
+		}
+	}
+	if (kind == TRACE_ERROR) {
+		fprintf(stderr, "fmtrace: %s is truncated or corrupt, trained on it up to the damage\n", path);
+	}
+	trace_unmap(&f);
+	free(last);
+	return kind == TRACE_END || kind == TRACE_ERROR;
+}
+
+// Fits a logistic regression to the clicks of the traces and writes it as a fixed point
+// model. Features are standardized for the descent and the scaling folded back into the
+// weights afterwards.
+static int train(const char *out_path, const char **traces, int ntraces) {
+	struct samples s = {0};
+	double mean[CLASSIFY_FEATURES] = {0}, scale[CLASSIFY_FEATURES] = {0};
+	double w[CLASSIFY_FEATURES] = {0}, b = 0;
+	uint64_t middle = 0, rule_right = 0, model_right = 0;
+
+	for (int i = 0; i < ntraces; i++) {
+		if (!collect(&s, traces[i])) {
+			free(s.v);
+			return 1;
+		}
+	}
+	double (*x)[CLASSIFY_FEATURES] = s.len > 0 ? malloc(s.len * sizeof(*x)) : NULL;
+	if (x == NULL) {
+		fputs(s.len > 0 ? "fmtrace: out of memory\n" : "fmtrace: no clicks to train on\n", stderr);
+		free(s.v);
+		return 1;
+	}
+
+	for (size_t i = 0; i < s.len; i++) {
+		int32_t f[CLASSIFY_FEATURES];
+		classify_features(s.v[i].contacts, s.v[i].len, f);
+		for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+			x[i][j] = (double)f[j] / CLASSIFY_ONE;
+			mean[j] += x[i][j] / s.len;
+		}
+		middle += s.v[i].middle;
+	}
+	for (size_t i = 0; i < s.len; i++) {
+		for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+			scale[j] += (x[i][j] - mean[j]) * (x[i][j] - mean[j]) / s.len;
+		}
+	}
+	for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+		// A feature that never varies only moves the bias.
+		scale[j] = scale[j] > 1e-12 ? sqrt(scale[j]) : 1;
+		for (size_t i = 0; i < s.len; i++) {
+			x[i][j] = (x[i][j] - mean[j]) / scale[j];
+		}
+	}
+
+	for (int step = 0; step < TRAIN_STEPS; step++) {
+		double gw[CLASSIFY_FEATURES] = {0}, gb = 0;
+		for (size_t i = 0; i < s.len; i++) {
+			double z = b;
+			for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+				z += w[j] * x[i][j];
+			}
+			double err = 1 / (1 + exp(-z)) - s.v[i].middle;
+			for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+				gw[j] += err * x[i][j];
+			}
+			gb += err;
+		}
+		for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+			w[j] -= TRAIN_RATE * gw[j] / s.len;
+		}
+		b -= TRAIN_RATE * gb / s.len;
+	}
+	free(x);
+
+	struct classify_model m = {CLASSIFY_MAGIC, CLASSIFY_VERSION, CLASSIFY_FEATURES, {0}, 0};
+	double bias = b, max_bias = (double)CLASSIFY_MAX_WEIGHT * 16 * CLASSIFY_FEATURES;
+	for (int j = 0; j < CLASSIFY_FEATURES; j++) {
+		double weight = fmax(-CLASSIFY_MAX_WEIGHT, fmin(CLASSIFY_MAX_WEIGHT, w[j] / scale[j]));
+		bias -= weight * mean[j];
+		m.weights[j] = (int32_t)lround(weight * CLASSIFY_ONE);
+	}
+	m.bias = (int64_t)llround(fmax(-max_bias, fmin(max_bias, bias)) * CLASSIFY_ONE * CLASSIFY_ONE);
+
+	FILE *out = fopen(out_path, "wb");
+	if (out == NULL || fwrite(&m, sizeof(m), 1, out) != 1 || fclose(out) != 0) {
+		fprintf(stderr, "fmtrace: cannot write %s\n", out_path);
+		free(s.v);
+		return 1;
+	}
+
+	for (size_t i = 0; i < s.len; i++) {
+		rule_right += (s.v[i].len == 3) == s.v[i].middle;
+		model_right += classify(&m, s.v[i].contacts, s.v[i].len) == s.v[i].middle;
+	}
+	volatile bool sink = false;
+	double start = now_s();
+	for (long i = 0; i < TRAIN_EVALUATIONS; i++) {
+		const struct sample *sample = &s.v[i % s.len];
+		sink ^= classify(&m, sample->contacts, sample->len);
+	}
+	double ns = (now_s() - start) * 1e9 / TRAIN_EVALUATIONS;
+
+	printf("%zu clicks, %llu meant as middle, %llu plain ones relabeled, %llu middle ones left out\n", s.len,
+		(unsigned long long)middle, (unsigned long long)s.relabeled, (unsigned long long)s.skipped);
+	printf("built-in rule %.1f%% right, model %.1f%% right, %.1fns per evaluation\n", 100.0 * rule_right / s.len,
+		100.0 * model_right / s.len, ns);
+	free(s.v);
+	return 0;
+}
+
+int main(int argc, const char **argv) {
+	if (argc <= 3 && argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+		// A trace of one's own is only read, anything else is a number of frames to record.
+		if (argc == 3 && access(argv[2], R_OK) == 0) {
+			return bench_read(argv[2]);
+		}
+		return bench(argc == 3 ? atol(argv[2]) : BENCH_FRAMES);
+	}
+	if (argc == 4 && strcmp(argv[1], "--seek") == 0) {
+		return seek(argv[2], argv[3]);
+	}
+	if (argc == 4 && strcmp(argv[1], "--script") == 0) {
+		return write_script(argv[2], argv[3]);
+	}
+	if (argc >= 4 && strcmp(argv[1], "--train") == 0) {
+		return train(argv[2], argv + 3, argc - 3);
+	}
+	if (argc < 2 || argv[1][0] == '-') {
+		fputs("usage: fmtrace trace.fmt...\n       fmtrace --script trace.fmt name\n       fmtrace --seek time|#click trace.fmt\n"
+			"       fmtrace --bench [frames|trace.fmt]\n       fmtrace --train model.fmm trace.fmt...\n",
+			stderr);
+		return 2;
+	}
+	paths = argv + 1;
+	npaths = argc - 1;
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads = cores < 1 ? 1 : cores < npaths ? (int)cores : npaths;
+	pthread_t *threads = calloc(nthreads, sizeof(*threads));
+	struct analysis *results = calloc(nthreads, sizeof(*results));
+	if (threads == NULL || results == NULL) {
+		fputs("fmtrace: out of memory\n", stderr);
+		return 1;
+	}
+
+	for (int i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &results[i]) != 0) {
+			fputs("fmtrace: cannot start worker thread\n", stderr);
+			return 1;
+		}
+	}
+	for (int i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (int i = 1; i < nthreads; i++) {
+		merge(&results[0], &results[i]);
+	}
+
+	report(&results[0]);
+	int errors = results[0].errors > 0;
+	free(results);
+	free(threads);
+	return errors;
+}
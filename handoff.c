@@ -0,0 +1,287 @@
+#ifdef __linux__
+#define _GNU_SOURCE // struct ucred
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "handoff.h"
+
+/*
+ * Upgrades without dropping a gesture. The running instance listens on a Unix socket,
+ * a new one connects to it at startup and, once its devices are registered and its tap
+ * is created but not yet enabled, sends a header. The old instance then leaves its run
+ * loop, disables its tap and answers with a header and its handoff_state. The new one
+ * enables its tap with that state applied and starts listening on the socket in turn.
+ *
+ * Every message starts with a handoff_header. A successor that doesn't understand the
+ * version still gets the tap, it just starts from scratch.
+ *
+ * Whoever holds the tap sees every click, so the socket is only accessible to its owner
+ * and both ends check the other runs as the same user before anything is handed over.
+ */
+
+#define HANDOFF_MAGIC 0x31484d46 // "FMH1"
+#define HANDOFF_VERSION 1
+// Longest the successor waits for the predecessor to step down.
+#define HANDOFF_TIMEOUT 2
+
+struct handoff_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // of the payload following the header
+	int32_t pid;
+};
+
+bool handoff_enabled = false;
+
+static struct sockaddr_un addr = {.sun_family = AF_UNIX};
+static int predecessor = -1;
+static int listener = -1;
+static int successor = -1;
+static _Atomic bool requested = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t released = PTHREAD_COND_INITIALIZER;
+static void (*on_ready)(void *ctx);
+static void *ready_ctx;
+
+static inline double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void socket_setup(int fd) {
+	struct timeval timeout = {HANDOFF_TIMEOUT, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+// Whether the process at the other end of the socket runs as our user.
+static bool peer_trusted(int fd) {
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+	uid_t uid;
+	gid_t gid;
+	return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+#ifdef MSG_NOSIGNAL
+	int flags = MSG_NOSIGNAL;
+#else
+	int flags = 0;
+#endif
+	for (const char *p = buf; len > 0;) {
+		ssize_t n = send(fd, p, len, flags);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+	for (char *p = buf; len > 0;) {
+		ssize_t n = recv(fd, p, len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool handoff_init(const char *path) {
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Handoff socket path %s is too long.\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+	handoff_enabled = true;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		// Nobody to take over from, we'll be listening ourselves.
+		close(fd);
+		return true;
+	}
+	if (!peer_trusted(fd)) {
+		fprintf(stderr, "Handoff socket %s belongs to another user, handoffs are off.\n", path);
+		close(fd);
+		handoff_enabled = false;
+		return false;
+	}
+	socket_setup(fd);
+	predecessor = fd;
+	return true;
+}
+
+bool handoff_successor(void) {
+	return predecessor >= 0;
+}
+
+bool handoff_receive(struct handoff_state *state, double *latency) {
+	struct handoff_header header = {HANDOFF_MAGIC, HANDOFF_VERSION, 0, getpid()};
+	double start = now();
+	bool ok = write_all(predecessor, &header, sizeof(header))
+		&& read_all(predecessor, &header, sizeof(header))
+		&& header.magic == HANDOFF_MAGIC;
+
+	if (ok && header.version == HANDOFF_VERSION && header.size == sizeof(*state)) {
+		ok = read_all(predecessor, state, sizeof(*state));
+	} else if (ok) {
+		fprintf(stderr, "Process %d handed off version %u state, starting from scratch.\n",
+			header.pid, header.version);
+		ok = false;
+	} else {
+		fputs("Handoff failed, starting from scratch.\n", stderr);
+	}
+	*latency = now() - start;
+
+	close(predecessor);
+	predecessor = -1;
+	return ok;
+}
+
+static void *listen_run(void *arg) {
+	struct handoff_header header;
+	int fd;
+
+	for (;;) {
+		fd = accept(listener, NULL, NULL);
+		if (fd < 0 && (errno == EINTR || errno == ECONNABORTED)) {
+			continue;
+		}
+		if (fd < 0) {
+			return NULL;
+		}
+		if (!peer_trusted(fd)) {
+			fputs("Refused a handoff to a process of another user.\n", stderr);
+			close(fd);
+			continue;
+		}
+
+		socket_setup(fd);
+		if (read_all(fd, &header, sizeof(header)) && header.magic == HANDOFF_MAGIC) {
+			break;
+		}
+		close(fd);
+	}
+
+	// Whatever version the successor is, it gets the tap.
+	pthread_mutex_lock(&lock);
+	successor = fd;
+	atomic_store(&requested, true);
+	while (successor >= 0) {
+		// The run loop may be between two runs and miss a stop, keep asking.
+		on_ready(ready_ctx);
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += 100000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&released, &lock, &deadline);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void handoff_listen(void (*ready)(void *ctx), void *ctx) {
+	pthread_t thread;
+
+	if (listener >= 0) {
+		return;
+	}
+	on_ready = ready;
+	ready_ctx = ctx;
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		fputs("Failed to create handoff socket.\n", stderr);
+		return;
+	}
+	// The socket is left behind by a predecessor that handed off, or one that crashed.
+	unlink(addr.sun_path);
+	// Sockets take their mode from the umask as they are bound, chmod afterwards would leave
+	// a moment others could connect in.
+	mode_t mask = umask(0177);
+	int bound = bind(listener, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (bound != 0 || listen(listener, 1) != 0
+		|| pthread_create(&thread, NULL, listen_run, NULL) != 0) {
+		fprintf(stderr, "Failed to listen for handoffs on %s.\n", addr.sun_path);
+		close(listener);
+		listener = -1;
+		return;
+	}
+	pthread_detach(thread);
+}
+
+bool handoff_requested(void) {
+	return atomic_load(&requested);
+}
+
+void handoff_release(struct handoff_state *state) {
+	struct handoff_header header = {HANDOFF_MAGIC, HANDOFF_VERSION, sizeof(*state), getpid()};
+
+	state->pid = getpid();
+	pthread_mutex_lock(&lock);
+	if (successor >= 0) {
+		if (!write_all(successor, &header, sizeof(header)) || !write_all(successor, state, sizeof(*state))) {
+			fputs("Failed to send handoff state.\n", stderr);
+		}
+		close(successor);
+		successor = -1;
+		pthread_cond_signal(&released);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void handoff_close(void) {
+	if (predecessor >= 0) {
+		close(predecessor);
+		predecessor = -1;
+	}
+	if (listener >= 0) {
+		// Wakes the thread blocked in accept.
+		shutdown(listener, SHUT_RDWR);
+		close(listener);
+		listener = -1;
+		// After a handoff the path belongs to the successor.
+		if (!handoff_requested()) {
+			unlink(addr.sun_path);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Devices beyond this are not handed over.
+#define HANDOFF_MAX_DEVICES 64
+
+// Tunables a build was made with, so a successor can tell its gestures will behave differently.
+struct handoff_config {
+	int32_t pos_quant;
+	float grip_edge;
+	float grip_rear;
+	float grip_size;
+	double max_frame_delay;
+};
+
+// Device as recognizable from another process, MTDeviceRefs only mean something to the
+// process that enumerated them.
+struct handoff_device {
+	int32_t family;
+	int32_t product;
+	int32_t width;
+	int32_t height;
+	uint8_t class;
+	uint8_t transport;
+	bool builtin;
+};
+
+// Gesture state the running instance passes to the one replacing it.
+struct handoff_state {
+	int32_t pid;
+	bool middle_click; // the button held down was turned into a middle click
+	uint32_t len;
+	struct handoff_device devices[HANDOFF_MAX_DEVICES];
+	struct handoff_config config;
+};
+
+// Set by handoff_init once FASTMIDDLE_HANDOFF names a socket.
+extern bool handoff_enabled;
+
+// Connects to the instance listening on path if there is one, making this one its successor.
+bool handoff_init(const char *path);
+bool handoff_successor(void);
+// Tells the predecessor we are ready and waits for it to give up the tap and send its state.
+// Returns false if there is no usable state, the predecessor has stepped down either way.
+bool handoff_receive(struct handoff_state *state, double *latency);
+
+// Accepts successors on the socket from a background thread. Once one is ready, ready is
+// called with ctx, again every 100ms, until the state is sent with handoff_release.
+void handoff_listen(void (*ready)(void *ctx), void *ctx);
+bool handoff_requested(void);
+void handoff_release(struct handoff_state *state);
+void handoff_close(void);
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Measures what deciding a click costs, and what the backend costs while nobody clicks.
+#
+#   idle      a trackpad with nothing on it, the run loop timers firing per second
+#   clicking  three fingers moving at 1 kHz, so every frame goes through decoding,
+#             filtering and publishing its decision, while the script clicks through the
+#             event tap, which only reads that decision. The shim times each frame from
+#             delivery until its decision is published, FASTMIDDLE_STATS the tap callback.
+#
+# Usage: linux/bench-decision.sh BINARY [CLICKS]
+set -eu
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 BINARY [CLICKS]" >&2
+	exit 2
+fi
+bin=$1
+clicks=${2:-1000}
+
+printf 'device 0\nmetrics\nwait 3000\nmetrics\n' | "$bin" 2>&1 | awk '
+	/^shim: pumped/ { wakeups = $13; seconds = $17 }
+	END { printf "idle      %.1f timer wakeups/s\n", wakeups / seconds }'
+
+script=$(
+	echo "device 0"
+	echo "pump 0 1000 $((clicks * 4)) 3"
+	i=0
+	while [ $i -lt "$clicks" ]; do echo down; echo up; echo "wait 3"; i=$((i + 1)); done
+	echo join
+	echo metrics
+	echo "wait 1100"
+)
+echo "$script" | FASTMIDDLE_STATS=1 "$bin" 2>&1 | awk -v clicks="$clicks" '
+	/-> other-down/ { middle++ }
+	/^shim: pumped/ { frames = $3; frame_ns = $7 }
+	/^fastmiddle:/ { calls = 0; ns = 0 }
+	/^  [a-z]/ { tap = $1 == "tap" }
+	tap && / calls / { calls += $2; ns += $2 * $5 }
+	END {
+		printf "clicking  %d frames, %d ns from delivery to the published decision\n", frames, frame_ns
+		printf "          %d clicks, %d middle, %d ns per click in the tap\n", clicks, middle, (calls > 0 ? ns / calls : 0)
+	}'
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Measures how the frame path scales with the number of devices. N devices pump frames
+# at 1 kHz each, from a thread of their own as MultitouchSupport delivers them, with the
+# contacts moving so every frame takes the whole path. For N = 1, 2, 4 ... 64 the shim
+# reports, from inside the process, the time each frame spends in the callback, the
+# frames a device would have lost because the previous one was still in it, how long
+# looking up a device nobody registered takes with N in the registry, and how long the
+# backend takes to reconcile its devices when one is unplugged and another plugged in.
+# Cache lines shared on the frame path show up as a cost per frame growing with N well
+# before N reaches the number of cores.
+#
+# Usage: linux/bench-devices.sh BINARY [FRAMES_PER_DEVICE]
+set -eu
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 BINARY [FRAMES_PER_DEVICE]" >&2
+	exit 2
+fi
+bin=$1
+frames=${2:-2000}
+
+echo "$(nproc) cores, $frames frames per device at 1000 Hz"
+printf '%7s %10s %9s %7s %10s %12s\n' devices frames ns/frame lost lookup-ns hotplug-us
+for n in 1 2 4 8 16 32 64; do
+	script=$(
+		i=0
+		while [ $i -lt $n ]; do echo "device 0"; i=$((i + 1)); done
+		i=0
+		while [ $i -lt $n ]; do echo "pump $i 1000 $frames 3"; i=$((i + 1)); done
+		echo join
+		echo metrics
+		echo "lookup 100000"
+		# Unplug one device and plug another in, the registry stays at N devices.
+		i=0
+		while [ $i -lt 16 ]; do echo "detach $i"; echo "attach 0"; i=$((i + 1)); done
+		echo metrics
+	)
+	echo "$script" | "$bin" 2>&1 > /dev/null | awk -v n=$n '
+		/^shim: pumped/ && !pumped { pumped = 1; frames = $3; lost = $5; ns = $7 }
+		/^shim: pumped/ { notes = $9; us = $11 }
+		/^shim: lookup/ { lookup = $3 }
+		END { printf "%7d %10d %9d %7d %10d %12.1f\n", n, frames, ns, lost, lookup, us }'
+done
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Measures the throughput of merging frames from several devices onto one timeline. N
+# devices pump moving contacts flat out, each from a thread of its own, for N = 2, 4, 8
+# and 16, once as the app normally runs and once with FASTMIDDLE_STATS on, which keeps
+# the watermark all devices advance to count the frames trailing the others as late, and
+# pays for timing every callback besides. The aggregate rate and the time a frame spends in
+# the callback come from the shim, on fewer cores than devices that time includes waiting
+# for the core.
+#
+# Usage: linux/bench-merge.sh BINARY [FRAMES_PER_DEVICE]
+set -eu
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 BINARY [FRAMES_PER_DEVICE]" >&2
+	exit 2
+fi
+bin=$1
+frames=${2:-100000}
+
+# Prints the aggregate Mframes/s, ns per frame in the callback and frames counted late.
+run() {
+	{
+		i=0
+		while [ $i -lt "$2" ]; do echo "device 0"; i=$((i + 1)); done
+		echo metrics
+		i=0
+		while [ $i -lt "$2" ]; do echo "pump $i 0 $frames 3"; i=$((i + 1)); done
+		echo join
+		echo metrics
+		[ -z "$3" ] || echo "wait 1100"
+	} | env $3 "$1" 2>&1 > /dev/null | awk '
+		/^shim: pumped/ { rate = $3 / $17 / 1e6; ns = $7 }
+		/^fastmiddle:/ { late = $9 }
+		END { printf "%10.2f %9d %9s", rate, ns, late == "" ? "-" : late }'
+}
+
+echo "$(nproc) cores, $frames frames per device"
+printf '%7s %10s %9s %9s %10s %9s %9s\n' sources Mframes/s ns/frame late stats-Mf/s ns/frame late
+for n in 2 4 8 16; do
+	printf '%7d %s %s\n' $n "$(run "$bin" $n '')" "$(run "$bin" $n FASTMIDDLE_STATS=1)"
+done
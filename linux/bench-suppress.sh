@@ -0,0 +1,89 @@
+#!/bin/sh
+# Measures what dropping unchanged frames before the decision stage saves. Each trace is
+# turned into a shim script with fmtrace --script and replayed on BINARY and on UNSUPPRESSED,
+# the same backend built with -DSUPPRESS_UNCHANGED=0, and FASTMIDDLE_STATS times the frame
+# callback of both. The replays publish their frames for a recognizer, with none reading
+# them: the built-in rule alone costs about what the check does, and a recognizer would
+# spend its own CPU on every frame passed on besides. Printed per trace: its frames, the
+# share suppressed, the frames a second still passed on to the decision stage, the time
+# spent in the frame callback with and without suppression and the CPU saved. Without
+# traces a synthetic session stands in: fingers resting with sensor noise and clicking,
+# moving, and lifted off.
+#
+# Usage: linux/bench-suppress.sh BINARY UNSUPPRESSED [TRACE.fmt...]
+set -eu
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 BINARY UNSUPPRESSED [TRACE.fmt...]" >&2
+	exit 2
+fi
+bin=$1
+unsuppressed=$2
+shift 2
+fmtrace=${FMTRACE:-./fmtrace}
+dir=$(mktemp -d)
+ring=/fastmiddle-bench-$$
+trap 'rm -rf "$dir"; rm -f /dev/shm$ring' EXIT
+
+session() {
+	awk 'BEGIN {
+		print "device 0"
+		srand(1)
+		t = 1
+		for (round = 0; round < 10; round++) {
+			for (i = 0; i < 2000; i++) {
+				printf "frame 0 %.3f", t += 0.001
+				for (f = 0; f < 3; f++) {
+					printf " %.4f,%.4f", 0.3 + 0.1 * f + (rand() - 0.5) * 0.002, 0.6 + (rand() - 0.5) * 0.002
+				}
+				print ""
+				if (i % 500 == 250) {
+					print "down"
+					print "up"
+				}
+			}
+			for (i = 0; i < 1000; i++) {
+				printf "frame 0 %.3f", t += 0.001
+				for (f = 0; f < 3; f++) {
+					printf " %.4f,%.4f", 0.3 + 0.1 * f, 0.6 - 0.3 * i / 1000
+				}
+				print ""
+			}
+			for (i = 0; i < 500; i++) {
+				printf "frame 0 %.3f\n", t += 0.001
+			}
+		}
+	}'
+}
+
+# Prints the frames, share suppressed and microseconds spent in the frame callback, the
+# fastest of three runs as the difference is small next to the noise of a loaded machine.
+replay() {
+	for run in 1 2 3; do
+		{ cat "$2"; echo "wait 1100"; } | FASTMIDDLE_STATS=1 FASTMIDDLE_RECOGNIZER=$ring "$1" 2>&1 > /dev/null | awk '
+			/^fastmiddle:/ { frames = $5; suppressed = substr($7, 2); ns = 0 }
+			/^  [a-z]/ { touch = $1 == "touch" }
+			touch && / calls / { ns += $2 * $5 }
+			END { print frames, suppressed, ns / 1000 }'
+	done | sort -n -k 3 | head -n 1
+}
+
+if [ $# -eq 0 ]; then
+	session > "$dir/session.txt"
+	set -- "$dir/session.txt"
+fi
+printf '%-24s %9s %11s %10s %13s %15s %7s\n' trace frames suppressed passed/s callback-us unsuppressed-us saved
+for trace in "$@"; do
+	script=$trace
+	case $trace in
+	*.fmt)
+		"$fmtrace" --script "$trace" "$dir/replay" > /dev/null
+		script=$dir/replay.txt
+		;;
+	esac
+	seconds=$(awk '$1 == "frame" { if (first == "") first = $3; last = $3 } END { print last - first }' "$script")
+	echo "$(replay "$bin" "$script") $(replay "$unsuppressed" "$script")" | awk -v name="$(basename "$trace")" -v s="$seconds" '{
+		printf "%-24s %9d %10.1f%% %10.1f %13.0f %15.0f %6.1f%%\n", name, $1, $2, $1 * (100 - $2) / 100 / s, $3, $6,
+			($6 > 0 ? 100 * ($6 - $3) / $6 : 0)
+	}'
+done
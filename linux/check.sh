@@ -0,0 +1,72 @@
+#!/bin/sh
+# Runs the shim tests in linux/tests against a build of fastmiddle-linux:
+#
+#   NAME.txt  script fed to the binary on stdin, "# env: VAR=value ..." lines set
+#             its environment
+#   NAME.out  expected stdout of the script
+#   NAME.err  lines that must each appear somewhere in stderr, optional
+#   NAME.sh   test run as a shell script with BIN set to the binary, passes on exit 0
+#
+# A sanitizer report or any other nonzero exit fails the test.
+#
+# Usage: linux/check.sh BINARY TEST...
+set -u
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 BINARY TEST..." >&2
+	exit 2
+fi
+
+BIN=$1
+export BIN
+shift
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+passed=0
+
+fail() {
+	echo "FAIL $1: $2"
+	sed 's/^/    /' "$tmp/stderr"
+	failed=$((failed + 1))
+}
+
+for test in "$@"; do
+	name=${test%.*}
+	case $test in
+	*.sh)
+		if sh "$test" > "$tmp/stderr" 2>&1; then
+			passed=$((passed + 1))
+		else
+			fail "$name" "exited with $?"
+		fi
+		continue
+		;;
+	*.txt) ;;
+	*) continue ;;
+	esac
+
+	vars=$(sed -n 's/^# env: //p' "$test" | tr '\n' ' ')
+	env $vars "$BIN" < "$test" > "$tmp/stdout" 2> "$tmp/stderr"
+	status=$?
+	if [ $status -ne 0 ]; then
+		fail "$name" "exited with $status"
+		continue
+	fi
+	if [ -f "$name.out" ] && ! diff -u "$name.out" "$tmp/stdout" > "$tmp/diff"; then
+		cat "$tmp/diff" >> "$tmp/stderr"
+		fail "$name" "unexpected output"
+		continue
+	fi
+	if [ -f "$name.err" ]; then
+		missing=$(while IFS= read -r line; do grep -qF -- "$line" "$tmp/stderr" || echo "$line"; done < "$name.err")
+		if [ -n "$missing" ]; then
+			fail "$name" "stderr lacks: $missing"
+			continue
+		fi
+	fi
+	passed=$((passed + 1))
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
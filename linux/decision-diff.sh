@@ -0,0 +1,55 @@
+#!/bin/sh
+# Replays shim scripts through two builds of fastmiddle-linux in parallel and
+# prints one tab-separated line per mouse event that comes out differently:
+#
+#   script  line  last frame before it  old result  new result
+#
+# An event only one build printed shows as - for the other.
+#
+# Usage: linux/decision-diff.sh OLD_BINARY NEW_BINARY SCRIPT...
+set -eu
+
+if [ "${1:-}" = "--one" ]; then
+	old=$(mktemp)
+	new=$(mktemp)
+	trap 'rm -f "$old" "$new"' EXIT
+	FASTMIDDLE_SHIM_ECHO=1 "$2" < "$4" > "$old" 2>/dev/null || true
+	FASTMIDDLE_SHIM_ECHO=1 "$3" < "$4" > "$new" 2>/dev/null || true
+	# Outputs are matched on the script line they came out on, the echo of each line aside,
+	# so an extra or missing event only shows up on its own line.
+	awk -F '\t' -v script="$4" '
+		{ file = FILENAME == ARGV[1] ? 1 : FILENAME == ARGV[2] ? 2 : 3 }
+		file == 1 {
+			sub(/^[ \t]+/, "")
+			line[FNR] = $0
+			frame[FNR] = /^frame / ? $0 : frame[FNR - 1]
+			lines = FNR
+			next
+		}
+		$2 == line[$1] && !echoed[file, $1]++ { next }
+		{ out[file, $1, ++n[file, $1]] = $2 }
+		END {
+			for (l = 1; l <= lines; l++) {
+				for (i = 1; i <= n[2, l] || i <= n[3, l]; i++) {
+					o = (2, l, i) in out ? out[2, l, i] : "-"
+					m = (3, l, i) in out ? out[3, l, i] : "-"
+					if (o != m) {
+						print script "\t" l "\t" frame[l] "\t" o "\t" m
+					}
+				}
+			}
+		}
+	' "$4" "$old" "$new"
+	exit 0
+fi
+
+if [ $# -lt 3 ]; then
+	echo "usage: $0 OLD_BINARY NEW_BINARY SCRIPT..." >&2
+	exit 2
+fi
+
+old=$1
+new=$2
+shift 2
+jobs=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+printf '%s\n' "$@" | xargs -P "$jobs" -I {} "$0" --one "$old" "$new" {} | sort -t "$(printf '\t')" -k1,1 -k2,2n
@@ -0,0 +1,1016 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "../backend.h"
+#include "../budget.h"
+
+/*
+ * Scripted stand-in for the macOS frameworks. CFRunLoopRun reads one command
+ * per line from stdin, blank lines and lines starting with '#' are skipped:
+ *
+ *   device <family> [builtin]     add a device before the backend enumerates them
+ *   attach <family> [builtin]     hotplug a device and fire the IOKit notification
+ *   detach <index>                unplug a device and fire the IOKit notification, frames
+ *                                 it still sends go to the callback it had, as frames
+ *                                 already in flight do
+ *   frame <index> <timestamp|now> [x,y[,size[,state[,identifier]]]]...
+ *                                 deliver one contact frame from a device, contacts
+ *                                 are numbered from 1 unless given an identifier, now
+ *                                 stamps it on the clock clicks are traced with
+ *   layout <finger|wide>          lay the contacts of later frames out as struct finger in
+ *                                 multitouch.h does, or with 8 more bytes after each one
+ *                                 as if a field had been added to it
+ *   pump <index> <hz> <frames> <fingers>
+ *                                 deliver frames from a background thread, as fast as
+ *                                 it can with a rate of 0, the contacts move a little
+ *                                 every frame
+ *   join                          wait for every pump to finish
+ *   lookup <count>                time that many frames from a device nobody registered,
+ *                                 the full search of the registry, printed to stderr
+ *   metrics                       print to stderr and reset the frames pumps delivered,
+ *                                 those a device would have lost as the callback took
+ *                                 longer than its period, the time spent in the callback,
+ *                                 the device notifications handled and their time, and
+ *                                 the run loop timers fired
+ *   down | up | drag              post a left mouse event through the event taps
+ *   move <x> <y>                  put the cursor there, events are posted at the cursor
+ *   timeout                       disable the taps as macOS does when they are too slow
+ *   disable                       disable the taps without telling them
+ *   mute <index>                  stop delivering a device's frames until it is restarted,
+ *                                 as can happen across sleep
+ *   invalidate                    invalidate the device notification port
+ *   stall <ms>                    block the run loop without servicing anything
+ *   slow <grip|trace> <ms>        hold the grip model or trace recording up that long on
+ *                                 every run, 0 lets it go again, check builds only
+ *   wait <ms>                     sleep while servicing run loop timers, until stopped
+ *   stop                          make CFRunLoopRun return
+ *   off                           stop the click loop, as switching the app off does
+ *   quit                          stop the click loop and exit, as the app's Quit does
+ *
+ * Every posted event is printed to stdout as it leaves the taps, events the backend
+ * synthesizes with CGEventPost are printed as "post <event>". With
+ * FASTMIDDLE_SHIM_ECHO set, each command is echoed first and every output line
+ * is prefixed with the script line number and a tab. A tap callback
+ * running longer than FASTMIDDLE_SHIM_TAP_TIMEOUT milliseconds (1000 by default)
+ * gets its tap disabled and is sent kCGEventTapDisabledByTimeout, as on macOS.
+ * The process exits at the end of the script.
+ *
+ * As in the app, where the click loop runs off the main thread, the thread reading the
+ * script and CFRunLoopGetMain are different: sources added to the main run loop fire on
+ * a thread of their own. attach and detach wait for it to handle the notification while
+ * the script thread keeps servicing its timers, and FASTMIDDLE_SHIM_MAIN_DELAY holds each
+ * notification back that many milliseconds as if the main thread were busy.
+ */
+
+#define MAX_VDEVICES 128
+#define MAX_TAPS 4
+#define MAX_TIMERS 8
+#define MAX_PUMPS 64
+#define MAX_LINE 4096
+
+enum cf_kind {
+	CF_STRING,
+	CF_NUMBER,
+	CF_ARRAY,
+	CF_SOURCE,
+	CF_TIMER,
+	CF_TAP,
+	CF_EVENT,
+};
+
+// Common header of every shim object.
+struct cf_object {
+	enum cf_kind kind;
+	bool constant;
+};
+
+struct __CFString {
+	struct cf_object obj;
+	const char *str;
+};
+
+struct __CFArray {
+	struct cf_object obj;
+	CFIndex len;
+	const void **values;
+};
+
+struct __CFRunLoop {
+	_Atomic bool stopped; // CFRunLoopStop may come from any thread
+};
+
+struct __CFRunLoopSource {
+	struct cf_object obj;
+	CFRunLoopRef loop; // the run loop it was added to
+	bool invalid;
+};
+
+struct __CFRunLoopTimer {
+	struct cf_object obj;
+	CFAbsoluteTime fire;
+	CFTimeInterval interval;
+	CFRunLoopTimerCallBack callback;
+	void *info;
+	bool valid;
+};
+
+struct __CFMachPort {
+	struct cf_object obj;
+	CGEventMask mask;
+	CGEventTapCallBack callback;
+	void *refcon;
+	bool enabled;
+	CFRunLoopSourceRef source;
+};
+
+struct __CGEvent {
+	struct cf_object obj;
+	CGEventType type;
+	CGPoint location;
+	CGEventTimestamp timestamp;
+	int64_t fields[kCGEventFieldCount];
+};
+
+struct IONotificationPort {
+	struct __CFRunLoopSource source;
+	IOServiceMatchingCallback callback;
+	void *refcon;
+};
+
+struct vdevice {
+	int family;
+	bool builtin;
+	_Atomic bool attached;
+	_Atomic int frame;
+	_Atomic bool running;
+	_Atomic bool muted;
+	MTContactCallback _Atomic callback;
+	MTContactCallback _Atomic retired; // the callback it had before it was unregistered
+};
+
+struct pump {
+	pthread_t thread;
+	struct vdevice *device;
+	int hz;
+	int frames;
+	int fingers;
+};
+
+static struct __CFString default_mode = {{CF_STRING, true}, "kCFRunLoopDefaultMode"};
+static struct __CFString common_modes = {{CF_STRING, true}, "kCFRunLoopCommonModes"};
+
+const CFAllocatorRef kCFAllocatorDefault = NULL;
+const CGPoint CGPointZero = {0, 0};
+const CFStringRef kCFRunLoopDefaultMode = &default_mode;
+const CFStringRef kCFRunLoopCommonModes = &common_modes;
+
+static struct __CFRunLoop loop;
+static struct __CFRunLoop main_loop;
+static pthread_t main_thread;
+// Notifications posted to the main thread and handled by it so far.
+static pthread_mutex_t main_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t main_cond = PTHREAD_COND_INITIALIZER;
+static int main_posted;
+static int main_handled;
+static useconds_t main_delay;
+static CFMachPortRef taps[MAX_TAPS];
+static CFRunLoopTimerRef timers[MAX_TIMERS];
+// Guards the notification port and where its source is, the backend rebuilds it from
+// the script thread while the main thread fires it.
+static pthread_mutex_t port_lock = PTHREAD_MUTEX_INITIALIZER;
+static IONotificationPortRef notify_port;
+static struct vdevice vdevices[MAX_VDEVICES];
+static int nvdevices;
+static struct pump pumps[MAX_PUMPS];
+static int npumps;
+static char *pending;
+static _Atomic int lineno; // also read by the threads posting events
+static bool echo;
+// Bytes after each contact of delivered frames, beyond the struct finger layout.
+static _Atomic int layout_pad;
+// Where CGEventCreate finds the cursor, only the script thread moves it.
+static CGPoint cursor;
+// Totals for metrics, pumps add theirs as they finish.
+static _Atomic uint64_t pumped_frames, pumped_lost, pumped_ns;
+static _Atomic uint64_t notified, notified_ns;
+// Run loop timers fired on the script thread, each one a wakeup of the click loop on macOS.
+static uint64_t timer_wakeups;
+static double metrics_since;
+
+// CoreFoundation
+
+CFStringRef __CFStringMakeConstantString(const char *str) {
+	static struct __CFString strings[64];
+	static int len;
+
+	for (int i = 0; i < len; i++) {
+		if (strcmp(strings[i].str, str) == 0) {
+			return &strings[i];
+		}
+	}
+	if (len == 64) {
+		fputs("shim: too many CFSTR constants\n", stderr);
+		abort();
+	}
+	strings[len] = (struct __CFString) {{CF_STRING, true}, str};
+	return &strings[len++];
+}
+
+void CFRelease(CFTypeRef cf) {
+	struct cf_object *obj = (struct cf_object *)cf;
+
+	if (obj == NULL || obj->constant) {
+		return;
+	}
+	switch (obj->kind) {
+	case CF_ARRAY:
+		free(((struct __CFArray *)obj)->values);
+		break;
+	case CF_TAP:
+		for (int i = 0; i < MAX_TAPS; i++) {
+			if (taps[i] == (CFMachPortRef)obj) {
+				taps[i] = NULL;
+			}
+		}
+		break;
+	case CF_TIMER:
+		CFRunLoopTimerInvalidate((CFRunLoopTimerRef)obj);
+		break;
+	default:
+		break;
+	}
+	free(obj);
+}
+
+CFTypeID CFGetTypeID(CFTypeRef cf) {
+	return ((const struct cf_object *)cf)->kind;
+}
+
+CFTypeID CFNumberGetTypeID(void) {
+	return CF_NUMBER;
+}
+
+CFTypeID CFStringGetTypeID(void) {
+	return CF_STRING;
+}
+
+bool CFNumberGetValue(CFNumberRef number, int type, void *value) {
+	return false;
+}
+
+int CFStringCompare(CFStringRef a, CFStringRef b, CFOptionFlags options) {
+	return strcmp(a->str, b->str);
+}
+
+CFIndex CFArrayGetCount(CFArrayRef array) {
+	return array->len;
+}
+
+const void *CFArrayGetValueAtIndex(CFArrayRef array, CFIndex i) {
+	return array->values[i];
+}
+
+CFAbsoluteTime CFAbsoluteTimeGetCurrent(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	// CoreFoundation counts from 2001-01-01.
+	return tv.tv_sec - 978307200.0 + tv.tv_usec / 1e6;
+}
+
+// Run loop
+
+CFRunLoopRef CFRunLoopGetMain(void) {
+	return &main_loop;
+}
+
+CFRunLoopRef CFRunLoopGetCurrent(void) {
+	return pthread_equal(pthread_self(), main_thread) ? &main_loop : &loop;
+}
+
+void CFRunLoopStop(CFRunLoopRef rl) {
+	rl->stopped = true;
+}
+
+void CFRunLoopAddSource(CFRunLoopRef rl, CFRunLoopSourceRef source, CFStringRef mode) {
+	pthread_mutex_lock(&port_lock);
+	source->loop = rl;
+	pthread_mutex_unlock(&port_lock);
+}
+
+void CFRunLoopRemoveSource(CFRunLoopRef rl, CFRunLoopSourceRef source, CFStringRef mode) {
+	pthread_mutex_lock(&port_lock);
+	source->loop = NULL;
+	pthread_mutex_unlock(&port_lock);
+}
+
+CFRunLoopTimerRef CFRunLoopTimerCreate(CFAllocatorRef allocator, CFAbsoluteTime fire, CFTimeInterval interval,
+	CFOptionFlags flags, CFIndex order, CFRunLoopTimerCallBack callback, CFRunLoopTimerContext *context) {
+	CFRunLoopTimerRef timer = calloc(1, sizeof(struct __CFRunLoopTimer));
+
+	*timer = (struct __CFRunLoopTimer) {
+		.obj = {CF_TIMER, false},
+		.fire = fire,
+		.interval = interval,
+		.callback = callback,
+		.info = context != NULL ? context->info : NULL,
+		.valid = true
+	};
+	return timer;
+}
+
+void CFRunLoopTimerSetTolerance(CFRunLoopTimerRef timer, CFTimeInterval tolerance) {
+}
+
+void CFRunLoopTimerInvalidate(CFRunLoopTimerRef timer) {
+	timer->valid = false;
+	for (int i = 0; i < MAX_TIMERS; i++) {
+		if (timers[i] == timer) {
+			timers[i] = NULL;
+		}
+	}
+}
+
+void CFRunLoopAddTimer(CFRunLoopRef rl, CFRunLoopTimerRef timer, CFStringRef mode) {
+	for (int i = 0; i < MAX_TIMERS; i++) {
+		if (timers[i] == NULL) {
+			timers[i] = timer;
+			return;
+		}
+	}
+	fputs("shim: too many run loop timers\n", stderr);
+	abort();
+}
+
+bool CFRunLoopSourceIsValid(CFRunLoopSourceRef source) {
+	pthread_mutex_lock(&port_lock);
+	bool valid = !source->invalid;
+	pthread_mutex_unlock(&port_lock);
+	return valid;
+}
+
+CFRunLoopSourceRef CFMachPortCreateRunLoopSource(CFAllocatorRef allocator, CFMachPortRef port, CFIndex order) {
+	CFRunLoopSourceRef source = calloc(1, sizeof(struct __CFRunLoopSource));
+
+	source->obj = (struct cf_object) {CF_SOURCE, false};
+	port->source = source;
+	return source;
+}
+
+// CoreGraphics
+
+CFMachPortRef CGEventTapCreate(int tap, int place, int options, CGEventMask mask, CGEventTapCallBack callback, void *refcon) {
+	for (int i = 0; i < MAX_TAPS; i++) {
+		if (taps[i] == NULL) {
+			taps[i] = calloc(1, sizeof(struct __CFMachPort));
+			*taps[i] = (struct __CFMachPort) {
+				.obj = {CF_TAP, false},
+				.mask = mask,
+				.callback = callback,
+				.refcon = refcon
+			};
+			return taps[i];
+		}
+	}
+	return NULL;
+}
+
+void CGEventTapEnable(CFMachPortRef tap, bool enable) {
+	tap->enabled = enable;
+}
+
+bool CGEventTapIsEnabled(CFMachPortRef tap) {
+	return tap->enabled;
+}
+
+CGEventRef CGEventCreateMouseEvent(CGEventSourceRef source, CGEventType type, CGPoint location, CGMouseButton button) {
+	CGEventRef event = calloc(1, sizeof(struct __CGEvent));
+
+	event->obj = (struct cf_object) {CF_EVENT, false};
+	event->type = type;
+	event->location = location;
+	event->fields[kCGMouseEventButtonNumber] = button;
+	return event;
+}
+
+CGEventRef CGEventCreate(CGEventSourceRef source) {
+	CGEventRef event = calloc(1, sizeof(struct __CGEvent));
+
+	event->obj = (struct cf_object) {CF_EVENT, false};
+	event->type = kCGEventNull;
+	event->location = cursor;
+	return event;
+}
+
+static const char *event_name(CGEventType type);
+
+// Synthesized events go straight to the output, the backend only posts middle button
+// events and none of its taps listen to those.
+void CGEventPost(int tap, CGEventRef event) {
+	flockfile(stdout);
+	if (echo) {
+		printf("%d\t", lineno);
+	}
+	printf("post %s button %lld at %g,%g\n", event_name(event->type),
+		(long long)event->fields[kCGMouseEventButtonNumber], event->location.x, event->location.y);
+	fflush(stdout);
+	funlockfile(stdout);
+}
+
+CGEventType CGEventGetType(CGEventRef event) {
+	return event->type;
+}
+
+CGPoint CGEventGetLocation(CGEventRef event) {
+	return event->location;
+}
+
+void CGEventSetLocation(CGEventRef event, CGPoint location) {
+	event->location = location;
+}
+
+void CGEventSetTimestamp(CGEventRef event, CGEventTimestamp timestamp) {
+	event->timestamp = timestamp;
+}
+
+void CGEventSetType(CGEventRef event, CGEventType type) {
+	event->type = type;
+}
+
+int64_t CGEventGetIntegerValueField(CGEventRef event, CGEventField field) {
+	return field < kCGEventFieldCount ? event->fields[field] : 0;
+}
+
+void CGEventSetIntegerValueField(CGEventRef event, CGEventField field, int64_t value) {
+	if (field < kCGEventFieldCount) {
+		event->fields[field] = value;
+	}
+}
+
+// IOKit
+
+IONotificationPortRef IONotificationPortCreate(mach_port_t port) {
+	IONotificationPortRef notify = calloc(1, sizeof(struct IONotificationPort));
+
+	notify->source.obj = (struct cf_object) {CF_SOURCE, true};
+	return notify;
+}
+
+void IONotificationPortDestroy(IONotificationPortRef port) {
+	pthread_mutex_lock(&port_lock);
+	if (notify_port == port) {
+		notify_port = NULL;
+	}
+	pthread_mutex_unlock(&port_lock);
+	free(port);
+}
+
+CFRunLoopSourceRef IONotificationPortGetRunLoopSource(IONotificationPortRef port) {
+	return &port->source;
+}
+
+CFMutableDictionaryRef IOServiceMatching(const char *name) {
+	return NULL;
+}
+
+kern_return_t IOServiceAddMatchingNotification(IONotificationPortRef port, const char *type, CFMutableDictionaryRef matching,
+	IOServiceMatchingCallback callback, void *refcon, io_iterator_t *iterator) {
+	pthread_mutex_lock(&port_lock);
+	port->callback = callback;
+	port->refcon = refcon;
+	notify_port = port;
+	pthread_mutex_unlock(&port_lock);
+	*iterator = IO_OBJECT_NULL;
+	return KERN_SUCCESS;
+}
+
+io_object_t IOIteratorNext(io_iterator_t iterator) {
+	return IO_OBJECT_NULL;
+}
+
+kern_return_t IOObjectRelease(io_object_t object) {
+	return KERN_SUCCESS;
+}
+
+CFTypeRef IORegistryEntrySearchCFProperty(io_service_t entry, const char *plane, CFStringRef key,
+	CFAllocatorRef allocator, IOOptionBits options) {
+	return NULL;
+}
+
+// MultitouchSupport
+
+CFMutableArrayRef MTDeviceCreateList(void) {
+	CFMutableArrayRef array = calloc(1, sizeof(struct __CFArray));
+
+	array->obj = (struct cf_object) {CF_ARRAY, false};
+	array->values = calloc(MAX_VDEVICES, sizeof(void *));
+	for (int i = 0; i < nvdevices; i++) {
+		if (atomic_load(&vdevices[i].attached)) {
+			array->values[array->len++] = &vdevices[i];
+		}
+	}
+	return array;
+}
+
+void MTRegisterContactFrameCallback(MTDeviceRef device, MTContactCallback callback) {
+	atomic_store(&((struct vdevice *)device)->callback, callback);
+}
+
+void MTUnregisterContactFrameCallback(MTDeviceRef device, MTContactCallback callback) {
+	atomic_store(&((struct vdevice *)device)->retired, atomic_exchange(&((struct vdevice *)device)->callback, NULL));
+}
+
+void MTDeviceStart(MTDeviceRef device, int mode) {
+	atomic_store(&((struct vdevice *)device)->muted, false);
+	atomic_store(&((struct vdevice *)device)->running, true);
+}
+
+void MTDeviceStop(MTDeviceRef device) {
+	atomic_store(&((struct vdevice *)device)->running, false);
+}
+
+void MTDeviceRelease(MTDeviceRef device) {
+}
+
+OSStatus MTDeviceGetFamilyID(MTDeviceRef device, int *family) {
+	*family = ((struct vdevice *)device)->family;
+	return 0;
+}
+
+OSStatus MTDeviceGetSensorSurfaceDimensions(MTDeviceRef device, int *width, int *height) {
+	*width = 0;
+	*height = 0;
+	return 0;
+}
+
+bool MTDeviceIsBuiltIn(MTDeviceRef device) {
+	return ((struct vdevice *)device)->builtin;
+}
+
+io_service_t MTDeviceGetService(MTDeviceRef device) {
+	return IO_OBJECT_NULL;
+}
+
+// Script driver
+
+static double monotonic() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void deliver(struct vdevice *device, struct finger *fingers, int n, double timestamp) {
+	MTContactCallback callback = atomic_load(&device->callback);
+	int frame = atomic_fetch_add(&device->frame, 1) + 1;
+	int pad = atomic_load(&layout_pad);
+	_Alignas(struct finger) char raw[32 * (sizeof(struct finger) + 8)];
+
+	for (int i = 0; i < n; i++) {
+		fingers[i].frame = frame;
+		fingers[i].timestamp = timestamp;
+	}
+	if (pad > 0) {
+		for (int i = 0; i < n && i < 32; i++) {
+			memcpy(raw + i * (sizeof(struct finger) + pad), &fingers[i], sizeof(struct finger));
+			memset(raw + i * (sizeof(struct finger) + pad) + sizeof(struct finger), 0xff, pad);
+		}
+		fingers = (struct finger *)raw;
+	}
+	if (callback != NULL && atomic_load(&device->running) && !atomic_load(&device->muted)) {
+		callback((int)(intptr_t)device, fingers, n, timestamp, frame);
+	} else if (!atomic_load(&device->attached) && (callback = atomic_load(&device->retired)) != NULL) {
+		callback((int)(intptr_t)device, fingers, n, timestamp, frame);
+	}
+}
+
+static void *pump_run(void *arg) {
+	struct pump *p = arg;
+	struct finger fingers[16] = {0};
+	int n = p->fingers < 16 ? p->fingers : 16;
+	double period = p->hz > 0 ? 1.0 / p->hz : 0;
+	double next = monotonic();
+	double busy = 0;
+	uint64_t lost = 0;
+
+	for (int i = 0; i < n; i++) {
+		fingers[i].identifier = i + 1;
+		fingers[i].state = 5;
+		fingers[i].size = 1;
+	}
+	for (int i = 0; i < p->frames; i++) {
+		// The contacts slide a grid cell every frame as a moving hand does, so frames take
+		// the whole path rather than the early return for a hand at rest.
+		for (int j = 0; j < n; j++) {
+			fingers[j].normalized.pos = (struct mt_point) {0.05f + fmodf(0.1f * j + (i % 16) / 32.0f, 0.9f), 0.5f};
+		}
+		double start = monotonic();
+		deliver(p->device, fingers, n, start);
+		double end = monotonic();
+		busy += end - start;
+		if (p->hz > 0) {
+			// A device keeps its own clock, the frames it had ready while the callback was
+			// still busy are gone. Count them and carry on from now.
+			next += period;
+			if (end > next) {
+				lost += (uint64_t)((end - next) / period);
+				next = end;
+			}
+			struct timespec deadline = {(time_t)next, (long)((next - (time_t)next) * 1e9)};
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		}
+	}
+	atomic_fetch_add(&pumped_frames, p->frames);
+	atomic_fetch_add(&pumped_lost, lost);
+	atomic_fetch_add(&pumped_ns, (uint64_t)(busy * 1e9));
+	return NULL;
+}
+
+// Fires the device notification if its source is on the given run loop.
+static void notify_on(CFRunLoopRef rl) {
+	IOServiceMatchingCallback callback = NULL;
+	void *refcon = NULL;
+
+	pthread_mutex_lock(&port_lock);
+	if (notify_port != NULL && notify_port->source.loop == rl && !notify_port->source.invalid) {
+		callback = notify_port->callback;
+		refcon = notify_port->refcon;
+	}
+	pthread_mutex_unlock(&port_lock);
+	if (callback != NULL) {
+		double start = monotonic();
+		callback(refcon, IO_OBJECT_NULL);
+		atomic_fetch_add(&notified_ns, (uint64_t)((monotonic() - start) * 1e9));
+		atomic_fetch_add(&notified, 1);
+	}
+}
+
+static void *main_run(void *arg) {
+	pthread_mutex_lock(&main_lock);
+	for (;;) {
+		while (main_handled == main_posted) {
+			pthread_cond_wait(&main_cond, &main_lock);
+		}
+		pthread_mutex_unlock(&main_lock);
+		usleep(main_delay);
+		notify_on(&main_loop);
+		pthread_mutex_lock(&main_lock);
+		main_handled++;
+		pthread_cond_broadcast(&main_cond);
+	}
+	return NULL;
+}
+
+static void run_timers();
+
+// Hands the notification to whichever thread runs its source and waits until it went
+// through, servicing the script thread's timers meanwhile.
+static void notify() {
+	notify_on(&loop);
+
+	pthread_mutex_lock(&main_lock);
+	int ticket = ++main_posted;
+	pthread_cond_broadcast(&main_cond);
+	while (main_handled < ticket) {
+		pthread_mutex_unlock(&main_lock);
+		run_timers();
+		usleep(100);
+		pthread_mutex_lock(&main_lock);
+	}
+	pthread_mutex_unlock(&main_lock);
+}
+
+static const char *event_name(CGEventType type) {
+	switch (type) {
+	case kCGEventLeftMouseDown: return "left-down";
+	case kCGEventLeftMouseUp: return "left-up";
+	case kCGEventLeftMouseDragged: return "left-drag";
+	case kCGEventOtherMouseDown: return "other-down";
+	case kCGEventOtherMouseUp: return "other-up";
+	case kCGEventOtherMouseDragged: return "other-drag";
+	default: return "unknown";
+	}
+}
+
+static void tap_disable(CFMachPortRef tap) {
+	struct __CGEvent null_event = {.obj = {CF_EVENT, true}, .type = kCGEventNull};
+
+	tap->enabled = false;
+	tap->callback(NULL, kCGEventTapDisabledByTimeout, &null_event, tap->refcon);
+}
+
+static void post(CGEventType type) {
+	static double timeout = -1;
+	struct __CGEvent storage = {.obj = {CF_EVENT, true}, .type = type, .location = cursor};
+	CGEventRef event = &storage;
+
+	if (timeout < 0) {
+		const char *env = getenv("FASTMIDDLE_SHIM_TAP_TIMEOUT");
+		timeout = (env != NULL ? atof(env) : 1000) / 1000;
+	}
+	// Taps see the event one after the other in creation order, like head-inserted taps do.
+	for (int i = 0; i < MAX_TAPS && event != NULL; i++) {
+		CFMachPortRef tap = taps[i];
+		if (tap == NULL || !tap->enabled || tap->source == NULL || tap->source->loop == NULL
+			|| (tap->mask & (UINT64_C(1) << event->type)) == 0) {
+			continue;
+		}
+
+		double start = monotonic();
+		event = tap->callback(NULL, event->type, event, tap->refcon);
+		if (monotonic() - start > timeout) {
+			tap_disable(tap);
+		}
+	}
+
+	if (echo) {
+		printf("%d\t", lineno);
+	}
+	if (event == NULL) {
+		printf("%s -> dropped\n", event_name(type));
+	} else {
+		printf("%s -> %s button %lld\n", event_name(type), event_name(event->type),
+			(long long)event->fields[kCGMouseEventButtonNumber]);
+	}
+	fflush(stdout);
+}
+
+static void run_timers() {
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+	for (int i = 0; i < MAX_TIMERS; i++) {
+		CFRunLoopTimerRef timer = timers[i];
+		if (timer != NULL && timer->valid && now >= timer->fire) {
+			timer->fire = timer->interval > 0 ? now + timer->interval : 0;
+			if (timer->interval <= 0) {
+				CFRunLoopTimerInvalidate(timer);
+			}
+			timer_wakeups++;
+			timer->callback(timer, timer->info);
+		}
+	}
+}
+
+static struct vdevice *vdevice_add(int family, bool builtin) {
+	if (nvdevices == MAX_VDEVICES) {
+		fputs("shim: too many devices\n", stderr);
+		exit(1);
+	}
+	vdevices[nvdevices] = (struct vdevice) {.family = family, .builtin = builtin, .attached = true};
+	return &vdevices[nvdevices++];
+}
+
+static struct vdevice *vdevice_get(int index) {
+	if (index < 0 || index >= nvdevices) {
+		fprintf(stderr, "shim: no device %d\n", index);
+		exit(1);
+	}
+	return &vdevices[index];
+}
+
+static void frame_command(char *args) {
+	struct finger fingers[32] = {0};
+	int n = 0;
+	char *tok = strtok(args, " \t");
+	struct vdevice *device = vdevice_get(tok != NULL ? atoi(tok) : -1);
+	double timestamp = (tok = strtok(NULL, " \t")) != NULL && strcmp(tok, "now") != 0 ? atof(tok) : monotonic();
+
+	while ((tok = strtok(NULL, " \t")) != NULL && n < 32) {
+		struct finger *f = &fingers[n];
+		float size = 1;
+		int state = 5;
+		int identifier = ++n;
+
+		sscanf(tok, "%f,%f,%f,%d,%d", &f->normalized.pos.x, &f->normalized.pos.y, &size, &state, &identifier);
+		f->identifier = identifier;
+		f->state = state;
+		f->size = size;
+	}
+	deliver(device, fingers, n, timestamp);
+}
+
+static void pump_command(char *args) {
+	struct pump *p = &pumps[npumps];
+	int index = 0;
+
+	if (npumps == MAX_PUMPS) {
+		fputs("shim: too many pumps\n", stderr);
+		exit(1);
+	}
+	*p = (struct pump) {.hz = 1000, .frames = 1000, .fingers = 3};
+	sscanf(args, "%d %d %d %d", &index, &p->hz, &p->frames, &p->fingers);
+	p->device = vdevice_get(index);
+	pthread_create(&p->thread, NULL, pump_run, p);
+	npumps++;
+}
+
+static void join_pumps() {
+	for (int i = 0; i < npumps; i++) {
+		pthread_join(pumps[i].thread, NULL);
+	}
+	npumps = 0;
+}
+
+// Times the frame callback on frames from a device the backend never registered, which
+// look every registered one up and match none.
+static void lookup_command(char *args) {
+	struct finger fingers[3] = {0};
+	static int unknown;
+	MTContactCallback callback = NULL;
+	int count = atoi(args);
+
+	for (int i = 0; i < nvdevices && callback == NULL; i++) {
+		callback = atomic_load(&vdevices[i].callback);
+	}
+	if (callback == NULL || count <= 0) {
+		fputs("shim: lookup needs a running device and a count\n", stderr);
+		return;
+	}
+	double start = monotonic();
+	for (int i = 0; i < count; i++) {
+		callback((int)(intptr_t)&unknown, fingers, 3, start, i + 1);
+	}
+	fprintf(stderr, "shim: lookup %.0f ns among %d devices\n", (monotonic() - start) * 1e9 / count, nvdevices);
+}
+
+static void metrics_command() {
+	uint64_t frames = atomic_exchange(&pumped_frames, 0);
+	uint64_t lost = atomic_exchange(&pumped_lost, 0);
+	uint64_t ns = atomic_exchange(&pumped_ns, 0);
+	uint64_t notes = atomic_exchange(&notified, 0);
+	uint64_t notes_ns = atomic_exchange(&notified_ns, 0);
+	double now = monotonic();
+
+	fprintf(stderr, "shim: pumped %llu frames, %llu lost, %.0f ns/frame, %llu notifications, %.0f us/notification, "
+		"%llu timer wakeups in %.3fs\n",
+		(unsigned long long)frames, (unsigned long long)lost, frames > 0 ? (double)ns / frames : 0,
+		(unsigned long long)notes, notes > 0 ? notes_ns / 1e3 / notes : 0, (unsigned long long)timer_wakeups,
+		now - metrics_since);
+	timer_wakeups = 0;
+	metrics_since = now;
+}
+
+static void slow_command(char *args) {
+#ifdef BUDGET_FAULTS
+	char stage[16] = "";
+	double ms = 0;
+	sscanf(args, "%15s %lf", stage, &ms);
+	uint64_t ns = (uint64_t)(ms * 1000000);
+
+	if (strcmp(stage, "grip") == 0) {
+		atomic_store(&budget_faults[BUDGET_GRIP], ns);
+	} else if (strcmp(stage, "trace") == 0) {
+		atomic_store(&budget_faults[BUDGET_TRACE_FRAME], ns);
+		atomic_store(&budget_faults[BUDGET_TRACE_CLICK], ns);
+	} else {
+		fprintf(stderr, "shim: unknown stage %s\n", stage);
+	}
+#else
+	fputs("shim: slow needs a build with -DBUDGET_FAULTS\n", stderr);
+#endif
+}
+
+static void wait_command(double ms) {
+	double until = monotonic() + ms / 1000;
+
+	while (monotonic() < until && !loop.stopped) {
+		run_timers();
+		usleep(1000);
+	}
+}
+
+static char *next_line() {
+	static char buf[MAX_LINE];
+
+	if (pending != NULL) {
+		char *line = pending;
+		pending = NULL;
+		return line;
+	}
+	while (fgets(buf, sizeof(buf), stdin) != NULL) {
+		lineno++;
+		buf[strcspn(buf, "\n")] = '\0';
+		char *line = buf + strspn(buf, " \t");
+		if (*line != '\0' && *line != '#') {
+			return line;
+		}
+	}
+	return NULL;
+}
+
+// Devices listed at the top of the script exist before the backend first enumerates them.
+__attribute__((constructor)) static void read_devices() {
+	char *line;
+
+	echo = getenv("FASTMIDDLE_SHIM_ECHO") != NULL;
+	const char *delay = getenv("FASTMIDDLE_SHIM_MAIN_DELAY");
+	main_delay = delay != NULL ? (useconds_t)(atof(delay) * 1000) : 0;
+	pthread_create(&main_thread, NULL, main_run, NULL);
+	while ((line = next_line()) != NULL) {
+		int family = 0;
+		char builtin[16] = "";
+		if (sscanf(line, "device %d %15s", &family, builtin) < 1) {
+			pending = line;
+			return;
+		}
+		vdevice_add(family, strcmp(builtin, "builtin") == 0);
+	}
+}
+
+void CFRunLoopRun(void) {
+	char *line;
+
+	loop.stopped = false;
+	if (metrics_since == 0) {
+		metrics_since = monotonic();
+	}
+	while (!loop.stopped && (line = next_line()) != NULL) {
+		char cmd[16] = "";
+		char *args = line + strcspn(line, " \t");
+		sscanf(line, "%15s", cmd);
+
+		if (echo) {
+			printf("%d\t%s\n", lineno, line);
+		}
+		run_timers();
+		if (strcmp(cmd, "frame") == 0) {
+			frame_command(args);
+		} else if (strcmp(cmd, "layout") == 0) {
+			atomic_store(&layout_pad, strstr(args, "wide") != NULL ? 8 : 0);
+		} else if (strcmp(cmd, "pump") == 0) {
+			pump_command(args);
+		} else if (strcmp(cmd, "join") == 0) {
+			join_pumps();
+		} else if (strcmp(cmd, "lookup") == 0) {
+			lookup_command(args);
+		} else if (strcmp(cmd, "metrics") == 0) {
+			metrics_command();
+		} else if (strcmp(cmd, "down") == 0) {
+			post(kCGEventLeftMouseDown);
+		} else if (strcmp(cmd, "up") == 0) {
+			post(kCGEventLeftMouseUp);
+		} else if (strcmp(cmd, "drag") == 0) {
+			post(kCGEventLeftMouseDragged);
+		} else if (strcmp(cmd, "move") == 0) {
+			sscanf(args, "%lf %lf", &cursor.x, &cursor.y);
+		} else if (strcmp(cmd, "timeout") == 0) {
+			for (int i = 0; i < MAX_TAPS; i++) {
+				if (taps[i] != NULL && taps[i]->enabled) {
+					tap_disable(taps[i]);
+				}
+			}
+		} else if (strcmp(cmd, "disable") == 0) {
+			for (int i = 0; i < MAX_TAPS; i++) {
+				if (taps[i] != NULL) {
+					taps[i]->enabled = false;
+				}
+			}
+		} else if (strcmp(cmd, "mute") == 0) {
+			atomic_store(&vdevice_get(atoi(args))->muted, true);
+		} else if (strcmp(cmd, "invalidate") == 0) {
+			pthread_mutex_lock(&port_lock);
+			if (notify_port != NULL) {
+				notify_port->source.invalid = true;
+			}
+			pthread_mutex_unlock(&port_lock);
+		} else if (strcmp(cmd, "stall") == 0) {
+			usleep((useconds_t)(atof(args) * 1000));
+		} else if (strcmp(cmd, "attach") == 0) {
+			char builtin[16] = "";
+			int family = 0;
+			sscanf(args, "%d %15s", &family, builtin);
+			vdevice_add(family, strcmp(builtin, "builtin") == 0);
+			notify();
+		} else if (strcmp(cmd, "detach") == 0) {
+			atomic_store(&vdevice_get(atoi(args))->attached, false);
+			notify();
+		} else if (strcmp(cmd, "slow") == 0) {
+			slow_command(args);
+		} else if (strcmp(cmd, "wait") == 0) {
+			wait_command(atof(args));
+		} else if (strcmp(cmd, "stop") == 0) {
+			loop.stopped = true;
+		} else if (strcmp(cmd, "off") == 0 || strcmp(cmd, "quit") == 0) {
+			// The first tap is the click tap, created with the state as its refcon.
+			if (taps[0] != NULL) {
+				stop_click_loop(taps[0]->refcon);
+			}
+			if (strcmp(cmd, "quit") == 0) {
+				join_pumps();
+				exit(0);
+			}
+		} else {
+			fprintf(stderr, "shim: unknown command %s\n", cmd);
+		}
+	}
+
+	if (!loop.stopped) {
+		join_pumps();
+		run_timers();
+		exit(0);
+	}
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+/*
+ * Minimal stand-ins for the parts of CoreFoundation, CoreGraphics, IOKit and
+ * MultitouchSupport that backend.c uses, so it builds unmodified on Linux.
+ * The run loop is driven by a script read from stdin, see shim.c.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+typedef long CFIndex;
+typedef unsigned long CFTypeID;
+typedef unsigned long CFOptionFlags;
+typedef double CFTimeInterval;
+typedef double CFAbsoluteTime;
+typedef int32_t OSStatus;
+
+typedef const void *CFTypeRef;
+typedef const struct __CFAllocator *CFAllocatorRef;
+typedef const struct __CFString *CFStringRef;
+typedef const struct __CFNumber *CFNumberRef;
+typedef const struct __CFArray *CFArrayRef;
+typedef struct __CFArray *CFMutableArrayRef;
+typedef struct __CFDictionary *CFMutableDictionaryRef;
+typedef struct __CFRunLoop *CFRunLoopRef;
+typedef struct __CFRunLoopSource *CFRunLoopSourceRef;
+typedef struct __CFRunLoopTimer *CFRunLoopTimerRef;
+typedef struct __CFMachPort *CFMachPortRef;
+
+typedef void (*CFRunLoopTimerCallBack)(CFRunLoopTimerRef timer, void *info);
+
+typedef struct {
+	CFIndex version;
+	void *info;
+	const void *(*retain)(const void *info);
+	void (*release)(const void *info);
+	CFStringRef (*copyDescription)(const void *info);
+} CFRunLoopTimerContext;
+
+enum {
+	kCFNumberIntType = 9,
+};
+
+enum {
+	kCFCompareEqualTo = 0,
+};
+
+extern const CFAllocatorRef kCFAllocatorDefault;
+extern const CFStringRef kCFRunLoopDefaultMode;
+extern const CFStringRef kCFRunLoopCommonModes;
+
+CFStringRef __CFStringMakeConstantString(const char *str);
+#define CFSTR(str) __CFStringMakeConstantString(str)
+
+void CFRelease(CFTypeRef cf);
+CFTypeID CFGetTypeID(CFTypeRef cf);
+CFTypeID CFNumberGetTypeID(void);
+CFTypeID CFStringGetTypeID(void);
+bool CFNumberGetValue(CFNumberRef number, int type, void *value);
+int CFStringCompare(CFStringRef a, CFStringRef b, CFOptionFlags options);
+CFIndex CFArrayGetCount(CFArrayRef array);
+const void *CFArrayGetValueAtIndex(CFArrayRef array, CFIndex i);
+CFAbsoluteTime CFAbsoluteTimeGetCurrent(void);
+
+CFRunLoopRef CFRunLoopGetMain(void);
+CFRunLoopRef CFRunLoopGetCurrent(void);
+void CFRunLoopRun(void);
+void CFRunLoopStop(CFRunLoopRef loop);
+void CFRunLoopAddSource(CFRunLoopRef loop, CFRunLoopSourceRef source, CFStringRef mode);
+void CFRunLoopRemoveSource(CFRunLoopRef loop, CFRunLoopSourceRef source, CFStringRef mode);
+CFRunLoopTimerRef CFRunLoopTimerCreate(CFAllocatorRef allocator, CFAbsoluteTime fire, CFTimeInterval interval,
+	CFOptionFlags flags, CFIndex order, CFRunLoopTimerCallBack callback, CFRunLoopTimerContext *context);
+void CFRunLoopTimerSetTolerance(CFRunLoopTimerRef timer, CFTimeInterval tolerance);
+void CFRunLoopTimerInvalidate(CFRunLoopTimerRef timer);
+void CFRunLoopAddTimer(CFRunLoopRef loop, CFRunLoopTimerRef timer, CFStringRef mode);
+bool CFRunLoopSourceIsValid(CFRunLoopSourceRef source);
+CFRunLoopSourceRef CFMachPortCreateRunLoopSource(CFAllocatorRef allocator, CFMachPortRef port, CFIndex order);
+
+// CoreGraphics events
+
+typedef struct __CGEvent *CGEventRef;
+typedef struct __CGEventSource *CGEventSourceRef;
+typedef struct __CGEventTapProxy *CGEventTapProxy;
+typedef uint32_t CGEventType;
+typedef uint32_t CGEventField;
+typedef uint64_t CGEventMask;
+typedef uint64_t CGEventTimestamp;
+typedef uint32_t CGMouseButton;
+
+typedef struct {
+	double x;
+	double y;
+} CGPoint;
+
+extern const CGPoint CGPointZero;
+
+typedef CGEventRef (*CGEventTapCallBack)(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *refcon);
+
+enum {
+	kCGEventNull = 0,
+	kCGEventLeftMouseDown = 1,
+	kCGEventLeftMouseUp = 2,
+	kCGEventRightMouseDown = 3,
+	kCGEventRightMouseUp = 4,
+	kCGEventMouseMoved = 5,
+	kCGEventLeftMouseDragged = 6,
+	kCGEventRightMouseDragged = 7,
+	kCGEventOtherMouseDown = 25,
+	kCGEventOtherMouseUp = 26,
+	kCGEventOtherMouseDragged = 27,
+	kCGEventTapDisabledByTimeout = 0xFFFFFFFE,
+	kCGEventTapDisabledByUserInput = 0xFFFFFFFF,
+};
+
+enum {
+	kCGMouseEventClickState = 1,
+	kCGMouseEventButtonNumber = 3,
+	kCGEventFieldCount = 64,
+};
+
+enum {
+	kCGMouseButtonLeft = 0,
+	kCGMouseButtonRight = 1,
+	kCGMouseButtonCenter = 2,
+};
+
+enum {
+	kCGHIDEventTap = 0,
+	kCGSessionEventTap = 1,
+};
+
+enum {
+	kCGHeadInsertEventTap = 0,
+};
+
+enum {
+	kCGEventTapOptionDefault = 0,
+	kCGEventTapOptionListenOnly = 1,
+};
+
+CFMachPortRef CGEventTapCreate(int tap, int place, int options, CGEventMask mask, CGEventTapCallBack callback, void *refcon);
+void CGEventTapEnable(CFMachPortRef tap, bool enable);
+bool CGEventTapIsEnabled(CFMachPortRef tap);
+CGEventRef CGEventCreate(CGEventSourceRef source);
+CGEventRef CGEventCreateMouseEvent(CGEventSourceRef source, CGEventType type, CGPoint location, CGMouseButton button);
+void CGEventPost(int tap, CGEventRef event);
+CGEventType CGEventGetType(CGEventRef event);
+CGPoint CGEventGetLocation(CGEventRef event);
+void CGEventSetLocation(CGEventRef event, CGPoint location);
+void CGEventSetTimestamp(CGEventRef event, CGEventTimestamp timestamp);
+void CGEventSetType(CGEventRef event, CGEventType type);
+int64_t CGEventGetIntegerValueField(CGEventRef event, CGEventField field);
+void CGEventSetIntegerValueField(CGEventRef event, CGEventField field, int64_t value);
+
+// IOKit
+
+typedef int kern_return_t;
+typedef unsigned int mach_port_t;
+typedef unsigned int io_object_t;
+typedef io_object_t io_iterator_t;
+typedef io_object_t io_service_t;
+typedef uint32_t IOOptionBits;
+typedef struct IONotificationPort *IONotificationPortRef;
+typedef void (*IOServiceMatchingCallback)(void *refcon, io_iterator_t iterator);
+
+#define KERN_SUCCESS 0
+#define KERN_FAILURE 5
+#define IO_OBJECT_NULL ((io_object_t)0)
+#define kIOMainPortDefault ((mach_port_t)0)
+#define kIOFirstMatchNotification "IOServiceFirstMatch"
+#define kIOServicePlane "IOService"
+
+enum {
+	kIORegistryIterateRecursively = 1,
+	kIORegistryIterateParents = 2,
+};
+
+IONotificationPortRef IONotificationPortCreate(mach_port_t port);
+void IONotificationPortDestroy(IONotificationPortRef port);
+CFRunLoopSourceRef IONotificationPortGetRunLoopSource(IONotificationPortRef port);
+CFMutableDictionaryRef IOServiceMatching(const char *name);
+kern_return_t IOServiceAddMatchingNotification(IONotificationPortRef port, const char *type, CFMutableDictionaryRef matching,
+	IOServiceMatchingCallback callback, void *refcon, io_iterator_t *iterator);
+io_object_t IOIteratorNext(io_iterator_t iterator);
+kern_return_t IOObjectRelease(io_object_t object);
+CFTypeRef IORegistryEntrySearchCFProperty(io_service_t entry, const char *plane, CFStringRef key,
+	CFAllocatorRef allocator, IOOptionBits options);
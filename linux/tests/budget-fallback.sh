@@ -0,0 +1,48 @@
+# A grip model running over budget hands the decision to the plain finger count, which takes
+# the palm for a fourth finger. Tripping again right after the cooldown doubles it, and 100
+# runs within budget trust the model again with the backoff starting over.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+g1='0.3,0.7 0.5,0.7 0.7,0.7 0.5,0.2,3'
+g2='0.3,0.7 0.5,0.7 0.7,0.72 0.5,0.2,3'
+{
+	echo 'device 112'
+	echo 'slow grip 5'
+	echo "frame 0 1.000 $g1"
+	echo "frame 0 1.001 $g2"
+	printf 'down\nup\nwait 250\n'
+	echo "frame 0 1.002 $g1"
+	echo "frame 0 1.003 $g2"
+	echo 'wait 250'
+	# Still off 450ms after the first trip, the second cooldown is twice as long.
+	echo "frame 0 1.004 $g1"
+	printf 'down\nup\nwait 200\nslow grip 0\n'
+	for i in $(seq 100 2 198); do
+		echo "frame 0 2.$i $g2"
+		echo "frame 0 2.$((i + 1)) $g1"
+	done
+	printf 'down\nup\nslow grip 5\n'
+	echo "frame 0 3.000 $g2"
+	echo "frame 0 3.001 $g1"
+	printf 'down\nup\nwait 250\nslow grip 0\n'
+	echo "frame 0 3.002 $g2"
+	echo "frame 0 3.003 $g1"
+	printf 'down\nup\nwait 100\n'
+} | FASTMIDDLE_FILTER=0 FASTMIDDLE_STATS=0.05 "$BIN" > "$dir/out" 2> "$dir/err"
+cat "$dir/out"
+cat > "$dir/expected" <<'OUT'
+left-down -> left-down button 0
+left-up -> left-up button 0
+left-down -> left-down button 0
+left-up -> left-up button 0
+left-down -> other-down button 2
+left-up -> other-up button 2
+left-down -> left-down button 0
+left-up -> left-up button 0
+left-down -> other-down button 2
+left-up -> other-up button 2
+OUT
+diff -u "$dir/expected" "$dir/out"
+grep 'budget grip' "$dir/err" | tail -1
+grep -q 'budget grip *3 trips' "$dir/err"
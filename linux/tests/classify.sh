@@ -0,0 +1,52 @@
+# A model trained on a session where two fingers pressing with the third about to land
+# were meant as middle clicks, as the third finger landing right after the plain click
+# tells, clicks middle on two fingers where the built-in rule doesn't, and plain on one.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+i=0
+while [ $i -lt 20 ]; do
+	cat <<-SCRIPT
+	frame 0 now 0.3,0.5 0.4,0.5 0.5,0.5
+	wait 60
+	down
+	up
+	frame 0 now
+	frame 0 now 0.4,0.5
+	down
+	up
+	frame 0 now
+	frame 0 now 0.3,0.5 0.5,0.5
+	down
+	up
+	frame 0 now 0.3,0.5 0.4,0.5 0.5,0.5
+	frame 0 now
+	wait 20
+	SCRIPT
+	i=$((i + 1))
+done > "$dir/session.txt"
+{ echo "device 0"; cat "$dir/session.txt"; } | FASTMIDDLE_TRACE="$dir/session.fmt" "$BIN" > /dev/null
+./fmtrace --train "$dir/model.fmm" "$dir/session.fmt" > "$dir/report"
+cat "$dir/report"
+grep -q "^60 clicks, 40 meant as middle, 20 plain ones relabeled, 0 middle ones left out" "$dir/report"
+grep -q "model 100.0% right" "$dir/report"
+
+script='device 0
+frame 0 1.00 0.3,0.5 0.5,0.5
+down
+up
+frame 0 1.01 0.4,0.5
+down
+up
+'
+printf '%s' "$script" | FASTMIDDLE_MODEL="$dir/model.fmm" "$BIN" > "$dir/out"
+cat "$dir/out"
+[ "$(cat "$dir/out")" = 'left-down -> other-down button 2
+left-up -> other-up button 2
+left-down -> left-down button 0
+left-up -> left-up button 0' ]
+
+echo garbage > "$dir/bad.fmm"
+printf '%s' "$script" | FASTMIDDLE_MODEL="$dir/bad.fmm" "$BIN" 2> "$dir/err" | head -1 | grep -q "left-down -> left-down"
+grep -q "Failed to load click model" "$dir/err"
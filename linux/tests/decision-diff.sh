@@ -0,0 +1,32 @@
+# decision-diff finds nothing between a build and itself, and exactly the click a
+# change flips. Here the change is turning the position filter off, which lets a finger
+# sliding onto the front of a Magic Mouse count a frame earlier. A build printing one event
+# more is only reported on the line it did so.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cat > "$dir/slide.txt" <<'SCRIPT'
+device 112
+frame 0 1.000 0.3,0.7 0.5,0.7 0.7,0.30
+frame 0 1.008 0.3,0.7 0.5,0.7 0.7,0.30
+frame 0 1.016 0.3,0.7 0.5,0.7 0.7,0.55
+down
+up
+SCRIPT
+printf '#!/bin/sh\nFASTMIDDLE_FILTER=0 exec "%s"\n' "$BIN" > "$dir/unfiltered"
+chmod +x "$dir/unfiltered"
+
+same=$(linux/decision-diff.sh "$BIN" "$BIN" linux/tests/*.txt "$dir/slide.txt")
+[ -z "$same" ]
+diff=$(linux/decision-diff.sh "$BIN" "$dir/unfiltered" "$dir/slide.txt")
+echo "$diff"
+[ "$(echo "$diff" | wc -l)" -eq 2 ]
+echo "$diff" | grep -q "slide.txt	5	frame 0 1.016 .*	left-down -> left-down button 0	left-down -> other-down button 2"
+
+printf '#!/bin/sh\n"%s" | awk -F "\t" '"'"'{ print } /other-down/ { print $1 "\tpost extra" }'"'"'\n' "$BIN" > "$dir/extra"
+chmod +x "$dir/extra"
+printf 'device 0\nframe 0 1.00 0.3,0.5 0.4,0.5 0.5,0.5\ndown\nup\nframe 0 1.01 0.3,0.5\ndown\nup\n' > "$dir/two.txt"
+diff=$(linux/decision-diff.sh "$BIN" "$dir/extra" "$dir/two.txt")
+echo "$diff"
+[ "$(echo "$diff" | wc -l)" -eq 1 ]
+echo "$diff" | grep -q "	-	post extra$"
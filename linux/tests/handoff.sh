@@ -0,0 +1,21 @@
+# A second instance takes over the tap and the middle click the first one latched. Only the
+# user running them may connect to the socket.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export FASTMIDDLE_HANDOFF="$dir/handoff.sock"
+
+printf 'device 0\nframe 0 1.00 0.3,0.5 0.4,0.5 0.5,0.5\ndown\nwait 5000\n' | "$BIN" > "$dir/old" 2> "$dir/old.err" &
+old=$!
+i=0
+while [ ! -S "$FASTMIDDLE_HANDOFF" ] && [ $i -lt 100 ]; do sleep 0.05; i=$((i + 1)); done
+[ "$(stat -c %a "$FASTMIDDLE_HANDOFF")" = 600 ]
+
+printf 'device 0\nup\n' | "$BIN" > "$dir/new" 2> "$dir/new.err"
+wait $old
+
+cat "$dir/old" "$dir/old.err" "$dir/new" "$dir/new.err"
+# The old instance let go of the click without releasing it, the new one finished it.
+[ "$(cat "$dir/old")" = "left-down -> other-down button 2" ]
+[ "$(cat "$dir/new")" = "left-up -> other-up button 2" ]
+grep -q "Took over from process $old" "$dir/new.err"
@@ -0,0 +1,16 @@
+# Eight frames laid out as struct finger are enough to trust the layout: the grip model
+# keeps seeing where the contacts are and a later odd frame is no longer probed.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+{
+	echo 'device 112'
+	for i in 1 2 3 4 5 6 7 8; do
+		echo "frame 0 1.0$i 0.3,0.7 0.5,0.7 0.7,0.7"
+	done
+	printf 'frame 0 1.10 0.3,0.7 0.5,0.7 0.7,0.7 0.5,0.2,3\ndown\nup\n'
+	printf 'layout wide\nframe 0 1.11 0.3,0.7 0.5,0.7\n'
+} | "$BIN" > "$dir/out" 2> "$dir/err"
+cat "$dir/out" "$dir/err"
+printf 'left-down -> other-down button 2\nleft-up -> other-up button 2\n' | diff -u - "$dir/out"
+! grep -q 'Unknown multitouch contact layout' "$dir/err"
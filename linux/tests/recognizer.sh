@@ -0,0 +1,38 @@
+# Clicks go with the out-of-process recognizer while it answers and with the built-in
+# rule once it is stopped, the check build gives it 50ms to answer so a slow run doesn't
+# fall back. The closing wait lets the stats timer report the counts.
+set -eu
+dir=$(mktemp -d)
+name=/fastmiddle-check-$$
+trap 'kill -9 $rec 2>/dev/null; rm -rf "$dir"; rm -f /dev/shm$name' EXIT
+export FASTMIDDLE_STATS=0.05 FASTMIDDLE_RECOGNIZER=$name
+
+script='device 0
+frame 0 1.00 0.3,0.5 0.4,0.5 0.5,0.5
+down
+up
+frame 0 1.01 0.3,0.5
+down
+up
+wait 100
+'
+expected='left-down -> other-down button 2
+left-up -> other-up button 2
+left-down -> left-down button 0
+left-up -> left-up button 0'
+
+# Create the ring before the recognizer attaches to it.
+printf 'device 0\n' | "$BIN" > /dev/null 2>&1
+./fmrecognize $name > /dev/null &
+rec=$!
+sleep 0.2
+printf '%s' "$script" | "$BIN" > "$dir/out" 2> "$dir/err"
+cat "$dir/out" "$dir/err"
+[ "$(cat "$dir/out")" = "$expected" ]
+grep -q "recognizer 2 clicks answered, 0 fell back" "$dir/err"
+
+kill -STOP $rec
+printf '%s' "$script" | "$BIN" > "$dir/out" 2> "$dir/err"
+cat "$dir/out" "$dir/err"
+[ "$(cat "$dir/out")" = "$expected" ]
+grep -q "recognizer 0 clicks answered, 2 fell back" "$dir/err"
@@ -0,0 +1,19 @@
+# A recorded session turned back into a script replays to the clicks it recorded, and the
+# tuner scores a build that decides them differently, but not one that only prints an
+# event more.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf 'device 0\nframe 0 1.00 0.3,0.3\ndown\nup\nframe 0 1.01 0.3,0.3 0.4,0.3 0.5,0.3\ndown\nup\n' \
+	| FASTMIDDLE_TRACE="$dir/session.fmt" "$BIN" > "$dir/out"
+./fmtrace --script "$dir/session.fmt" "$dir/session"
+diff -u "$dir/out" "$dir/session.out"
+"$BIN" < "$dir/session.txt" | diff -u "$dir/out" -
+[ "$(linux/tune.sh --one "$BIN" "$dir/session.txt" x)" = "x 2 0 0" ]
+printf '#!/bin/sh\n"%s" | awk -F "\t" '"'"'{ print } NR == 2 { print $1 "\tpost left-up" }'"'"'\n' "$BIN" > "$dir/extra"
+chmod +x "$dir/extra"
+[ "$(linux/tune.sh --one "$dir/extra" "$dir/session.txt" x)" = "x 2 0 0" ]
+# As a Magic Mouse the three fingers are behind the grip line, so the middle click is missed.
+sed -i 's/^device 0$/device 112/' "$dir/session.txt"
+[ "$(linux/tune.sh --one "$BIN" "$dir/session.txt" x)" = "x 2 1 0" ]
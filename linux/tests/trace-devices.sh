@@ -0,0 +1,33 @@
+# Per-device rows follow the devices the trace records, not their registry slots: the
+# trackpad in slot 0 is unplugged and a mouse takes the slot over, and another trace
+# has a mouse in slot 0 from the start. The two mice share a row, the trackpad keeps its
+# own, and no interval spans the hotplug.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+FASTMIDDLE_TRACE="$dir/hotplug.fmt" "$BIN" > /dev/null <<'SCRIPT'
+device 98 builtin
+frame 0 1.000 0.4,0.5
+frame 0 1.010 0.4,0.5 0.5,0.5
+frame 0 1.020
+detach 0
+attach 112
+frame 1 9.000 0.4,0.5
+frame 1 9.001 0.4,0.5 0.5,0.5
+frame 1 9.002
+SCRIPT
+FASTMIDDLE_TRACE="$dir/mouse.fmt" "$BIN" > /dev/null <<'SCRIPT'
+device 112
+frame 0 1.000 0.4,0.5
+frame 0 1.001 0.4,0.5 0.5,0.5
+SCRIPT
+./fmtrace "$dir/hotplug.fmt" "$dir/mouse.fmt" > "$dir/report"
+cat "$dir/report"
+grep -Eq "^family 98 product 0 builtin +3 +10.000 " "$dir/report"
+grep -Eq "^family 112 product 0 +5 +1.000 " "$dir/report"
+if grep -q "^slot " "$dir/report"; then exit 1; fi
+
+# The script replays each slot as the device it first held.
+./fmtrace --script "$dir/hotplug.fmt" "$dir/hotplug"
+grep -qx "device 98 builtin" "$dir/hotplug.txt"
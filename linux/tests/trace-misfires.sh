@@ -0,0 +1,37 @@
+# Misfire candidates are reported as rates of the clicks decided each way: of two middle
+# clicks one came right as the third finger landed, of two plain clicks one was followed
+# by three fingers right away.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+FASTMIDDLE_TRACE="$dir/session.fmt" "$BIN" > /dev/null <<'SCRIPT'
+device 0
+frame 0 now 0.3,0.5 0.4,0.5 0.5,0.5
+wait 60
+down
+up
+frame 0 now
+wait 60
+frame 0 now 0.3,0.5 0.4,0.5 0.5,0.5
+down
+up
+frame 0 now
+wait 60
+frame 0 now 0.4,0.5
+wait 60
+down
+up
+frame 0 now 0.3,0.5 0.4,0.5 0.5,0.5
+frame 0 now
+wait 60
+frame 0 now 0.4,0.5
+wait 60
+down
+up
+frame 0 now
+SCRIPT
+./fmtrace "$dir/session.fmt" > "$dir/report"
+cat "$dir/report"
+grep -q "^misfire candidates: 1 of 2 middle clicks within 50ms of a count change, 50.00% false positives" "$dir/report"
+grep -q " 1 of 2 plain clicks followed by three fingers within 50ms, 50.00% false negatives" "$dir/report"
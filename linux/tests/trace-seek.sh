@@ -0,0 +1,25 @@
+# Seeking into a trace of several index blocks lands on the first frame at or after a time
+# and on a click by its number, as scanning from the start would. The frames are paced so
+# the recorder keeps up with them.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk 'BEGIN {
+	print "device 0"
+	for (i = 0; i < 6000; i++) {
+		x = 0.3 + (i % 100) / 1000
+		printf "frame 0 %.3f %.3f,0.5 %.3f,0.5 %.3f,0.5\n", 1 + i / 1000, x, x + 0.1, x + 0.2
+		if (i % 250 == 249) print "wait 20"
+	}
+	print "down\nup\nframe 0 7.000 0.3,0.5\ndown\nup"
+}' | FASTMIDDLE_TRACE="$dir/session.fmt" "$BIN" > /dev/null
+./fmtrace --seek 4.5 "$dir/session.fmt" > "$dir/time"
+./fmtrace --seek 4.5004 "$dir/session.fmt" > "$dir/between"
+./fmtrace --seek '#2' "$dir/session.fmt" > "$dir/click"
+head -2 "$dir/time" "$dir/between" "$dir/click"
+[ "$(wc -c < "$dir/session.fmt.idx")" -gt 24 ]
+head -1 "$dir/time" | grep -q '^4\.500000	frame 0 0\.3000,0\.5000,1\.000,5,1 '
+head -1 "$dir/between" | grep -q '^4\.501000	frame 0 '
+[ "$(wc -l < "$dir/time")" -eq 20 ]
+[ "$(head -1 "$dir/click" | cut -f 2)" = "down left" ]
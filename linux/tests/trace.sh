@@ -0,0 +1,11 @@
+# Frames from two devices pumping at once, and a third device's frame and click in between,
+# all reach the trace through the queue and the writer thread by the time the process exits.
+set -eu
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf 'device 0\ndevice 0\ndevice 0\npump 0 1000 300 3\npump 1 1000 300 2\nframe 2 1.0 0.3,0.5 0.4,0.5 0.5,0.5\ndown\nup\njoin\n' \
+	| FASTMIDDLE_TRACE="$dir/session.fmt" "$BIN" > "$dir/out"
+./fmtrace "$dir/session.fmt" > "$dir/report"
+cat "$dir/out" "$dir/report"
+[ "$(head -1 "$dir/report")" = "1 files, 601 frames, 1 clicks (1 middle)" ]
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Sweeps the build time tunables over replays of recorded sessions. Every combination of
+# the given values gets a shim build, every build replays every script in parallel, and
+# each click coming out differently from the script's .out counts against the build:
+#
+#   config  clicks  missed middle clicks  misfired middle clicks
+#
+# Scripts come from fmtrace --script, or are any of linux/tests/*.txt with their "# env:"
+# lines. CC and CFLAGS are used for the builds as by make.
+#
+# Usage: linux/tune.sh NAME=VALUE[,VALUE...]... -- SCRIPT...
+set -eu
+
+if [ "${1:-}" = "--one" ]; then
+	# Not through env, the binaries are named after their defines.
+	vars=$(sed -n 's/^# env: //p' "$3" | tr '\n' ' ')
+	[ -z "$vars" ] || export $vars
+	# Scripts without expected clicks have nothing to score.
+	[ -f "${3%.*}.out" ] || exit 0
+	actual=$(mktemp)
+	trap 'rm -f "$actual"' EXIT
+	FASTMIDDLE_SHIM_ECHO=1 "$2" < "$3" > "$actual" 2>/dev/null || true
+	# The .out has one line per event posted, in order: the nth event line goes with the nth
+	# down, up or drag of the script, and is compared to what the build printed on that line.
+	awk -F '\t' '
+		{ file = FILENAME == ARGV[1] ? 1 : FILENAME == ARGV[2] ? 2 : 3 }
+		file == 1 && $0 ~ /^[ \t]*(down|up|drag)[ \t]*$/ { posted[++events] = FNR }
+		file == 2 && /^left-/ { expected[posted[++n]] = $0 }
+		file == 3 && $2 ~ /^left-/ && !($1 in actual) { actual[$1] = $2 }
+		END {
+			for (l in expected) {
+				clicks += expected[l] ~ /^left-down/
+				missed += expected[l] ~ /other-down/ && actual[l] !~ /other-down/
+				misfired += expected[l] ~ /^left-down -> left-down/ && actual[l] ~ /other-down/
+			}
+			printf "%d %d %d\n", clicks, missed, misfired
+		}
+	' "$3" "${3%.*}.out" "$actual" | sed "s|^|$4 |"
+	exit 0
+fi
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+configs=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+	name=${1%%=*}
+	values=$(echo "${1#*=}" | tr ',' ' ')
+	next=""
+	for config in ${configs:-:}; do
+		for value in $values; do
+			next="$next ${config%:}:$name=$value"
+		done
+	done
+	configs=$next
+	shift
+done
+if [ $# -lt 2 ] || [ -z "$configs" ]; then
+	echo "usage: $0 NAME=VALUE[,VALUE...]... -- SCRIPT..." >&2
+	exit 2
+fi
+shift
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+jobs=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+sources=$(sed -n 's/^C_SOURCES = //p' "$root/Makefile" | tr ' ' '\n' | sed "s|^|$root/|")
+
+# Configs are named by their defines, joined with ':' so they survive word splitting.
+for config in $configs; do
+	echo "$config"
+done | xargs -P "$jobs" -I {} sh -c '
+	defines=$(echo "$1" | tr ":" "\n" | sed -n "s/^./-D&/p")
+	${CC:-cc} ${CFLAGS:--O2} $defines -I"$2/linux" -DSTANDALONE $3 "$2/linux/shim.c" -o "$4/$1" -lpthread -lm
+' sh {} "$root" "$sources" "$dir"
+
+for config in $configs; do
+	for script in "$@"; do
+		printf '%s\t%s\n' "$config" "$script"
+	done
+done | xargs -P "$jobs" -L 1 sh -c '"$0" --one "$1/$2" "$3" "$2"' "$0" "$dir" \
+	| awk '
+		{ clicks[$1] += $2; missed[$1] += $3; misfired[$1] += $4 }
+		END { for (c in clicks) printf "%s\t%d\t%d\t%d\n", substr(c, 2), clicks[c], missed[c], misfired[c] }
+	' | sort
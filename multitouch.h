@@ -2,6 +2,7 @@
 
 #include <ApplicationServices/ApplicationServices.h>
 #include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
 
 /*
  * DISCLAIMER:
@@ -53,3 +54,7 @@ extern void MTDeviceStart(MTDeviceRef, int);
 extern void MTDeviceStop(MTDeviceRef);
 extern void MTUnregisterContactFrameCallback(MTDeviceRef, MTContactCallback);
 extern void MTDeviceRelease(MTDeviceRef);
+extern OSStatus MTDeviceGetFamilyID(MTDeviceRef, int*);
+extern OSStatus MTDeviceGetSensorSurfaceDimensions(MTDeviceRef, int*, int*);
+extern bool MTDeviceIsBuiltIn(MTDeviceRef);
+extern io_service_t MTDeviceGetService(MTDeviceRef);
@@ -0,0 +1,122 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recognize.h"
+#include "stats.h"
+
+// Longest the tap waits for the recognizer to answer the frames published before a click.
+#ifndef RECOGNIZE_DEADLINE_US
+#define RECOGNIZE_DEADLINE_US 2000
+#endif
+// Meanwhile the tap sleeps, first RECOGNIZE_POLL_US between looks at the ring, then doubling
+// up to RECOGNIZE_MAX_POLL_US.
+#ifndef RECOGNIZE_POLL_US
+#define RECOGNIZE_POLL_US 10
+#endif
+#ifndef RECOGNIZE_MAX_POLL_US
+#define RECOGNIZE_MAX_POLL_US 200
+#endif
+
+bool recognize_enabled = false;
+
+static struct recognize_ring *ring;
+// Clicks decided by the recognizer, and by the built-in rule because it missed the deadline.
+static _Atomic uint64_t answers = 0;
+static _Atomic uint64_t misses = 0;
+
+bool recognize_init(const char *name) {
+	struct stat st;
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+
+	if (fd < 0) {
+		return false;
+	}
+	// macOS only lets a shared memory object be sized once.
+	if (fstat(fd, &st) != 0 || (st.st_size != sizeof(*ring) && ftruncate(fd, sizeof(*ring)) != 0)) {
+		close(fd);
+		return false;
+	}
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED) {
+		ring = NULL;
+		return false;
+	}
+
+	memset(ring, 0, sizeof(*ring));
+	ring->version = RECOGNIZE_VERSION;
+	ring->pid = getpid();
+	atomic_store_explicit(&ring->magic, RECOGNIZE_MAGIC, memory_order_release);
+	recognize_enabled = true;
+	return true;
+}
+
+static inline uint64_t publish(enum recognize_kind kind, int device, double timestamp,
+	const struct contact *contacts, int n, int nFingers) {
+	uint64_t ticket = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+	struct recognize_frame *f = &ring->frames[ticket % RECOGNIZE_SLOTS];
+
+	atomic_store_explicit(&f->seq, 2 * ticket + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	f->kind = kind;
+	f->device = device;
+	f->timestamp = timestamp;
+	f->fingers = nFingers;
+	f->len = n;
+	if (n > 0) {
+		memcpy(f->contacts, contacts, n * sizeof(*contacts));
+	}
+	atomic_store_explicit(&f->published, stats_clock(CLOCK_MONOTONIC), memory_order_relaxed);
+	atomic_store_explicit(&f->seq, 2 * ticket + 2, memory_order_release);
+	return ticket;
+}
+
+void recognize_frame(int device, double timestamp, const struct contact *contacts, int n, int nFingers) {
+	publish(RECOGNIZE_FRAME, device, timestamp, contacts, n, nFingers);
+}
+
+void recognize_reset(void) {
+	publish(RECOGNIZE_RESET, -1, 0, NULL, 0, 0);
+}
+
+uint64_t recognize_decision(double timestamp, uint64_t builtin) {
+	uint64_t now = stats_clock(CLOCK_MONOTONIC);
+	uint64_t deadline = now + RECOGNIZE_DEADLINE_US * 1000ull;
+	uint64_t answered = atomic_load_explicit(&ring->answered, memory_order_acquire);
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	// A recognizer that is gone, or already a deadline behind, costs the click nothing.
+	bool behind = answered < head && now - atomic_load_explicit(
+		&ring->frames[answered % RECOGNIZE_SLOTS].published, memory_order_relaxed) > RECOGNIZE_DEADLINE_US * 1000ull;
+	uint64_t ticket = publish(RECOGNIZE_CLICK, -1, timestamp, NULL, 0, 0);
+	uint64_t poll = RECOGNIZE_POLL_US * 1000ull;
+
+	// Sleep rather than spin, the recognizer may well need this core to answer.
+	while (!behind && answered <= ticket && (now = stats_clock(CLOCK_MONOTONIC)) < deadline) {
+		uint64_t ns = poll < deadline - now ? poll : deadline - now;
+		nanosleep(&(struct timespec) {0, (long)ns}, NULL);
+		poll = poll < RECOGNIZE_MAX_POLL_US * 1000ull / 2 ? poll * 2 : RECOGNIZE_MAX_POLL_US * 1000ull;
+		answered = atomic_load_explicit(&ring->answered, memory_order_acquire);
+	}
+	// Past head the recognizer is still answering a previous run of the core.
+	if (answered <= ticket || answered > atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+		atomic_fetch_add_explicit(&misses, 1, memory_order_relaxed);
+		return builtin;
+	}
+	atomic_fetch_add_explicit(&answers, 1, memory_order_relaxed);
+	return atomic_load_explicit(&ring->decision, memory_order_relaxed);
+}
+
+void recognize_report(FILE *f) {
+	uint64_t a = atomic_load_explicit(&answers, memory_order_relaxed);
+	uint64_t m = atomic_load_explicit(&misses, memory_order_relaxed);
+
+	if (a + m > 0) {
+		fprintf(f, "  recognizer %llu clicks answered, %llu fell back to the built-in rule\n",
+			(unsigned long long)a, (unsigned long long)m);
+	}
+	fflush(f);
+}
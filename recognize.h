@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+/*
+ * Shared memory between the core and an out-of-process gesture recognizer. The core
+ * publishes every frame it lets through and every click into a ring, the recognizer
+ * decides on them in order and answers through a single decision word, one bit per device
+ * slot like click_decision. The tap clicks with the answer if the recognizer gets past the
+ * click within the deadline, and with the built-in rule otherwise.
+ */
+
+#define RECOGNIZE_MAGIC 0x31524d46 // "FMR1"
+#define RECOGNIZE_VERSION 1
+#define RECOGNIZE_SLOTS 256
+
+enum recognize_kind {
+	RECOGNIZE_FRAME,
+	RECOGNIZE_CLICK, // the tap is waiting for an answer
+	RECOGNIZE_RESET, // device slots were reassigned, forget every vote
+};
+
+struct recognize_frame {
+	_Atomic uint64_t seq; // 2 * ticket + 1 while being written, 2 * ticket + 2 once complete
+	_Atomic uint64_t published; // ns on CLOCK_MONOTONIC
+	int32_t kind;
+	int32_t device;
+	double timestamp;
+	int32_t fingers; // as reported by MultitouchSupport, contacts holds the decoded ones
+	int32_t len;
+	struct contact contacts[MAX_CONTACTS];
+};
+
+struct recognize_ring {
+	_Atomic uint32_t magic; // written last, once the rest of the header is
+	uint32_t version;
+	int32_t pid; // of the core, changes when it restarts
+	_Alignas(64) _Atomic uint64_t head; // tickets handed out
+	// Written by the recognizer only.
+	_Alignas(64) _Atomic uint64_t answered; // tickets decided on, in order
+	_Atomic uint64_t decision;
+	_Alignas(64) struct recognize_frame frames[RECOGNIZE_SLOTS];
+};
+
+// Set by recognize_init once the ring is mapped.
+extern bool recognize_enabled;
+
+bool recognize_init(const char *name);
+void recognize_frame(int device, double timestamp, const struct contact *contacts, int n, int nFingers);
+void recognize_reset(void);
+// Publishes a click at timestamp and returns the decision to click with, the built-in one
+// if the recognizer does not answer in time.
+uint64_t recognize_decision(double timestamp, uint64_t builtin);
+void recognize_report(FILE *f);
@@ -0,0 +1,87 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+struct callback_stats {
+	_Atomic uint64_t calls;
+	_Atomic uint64_t ns;
+};
+
+bool stats_enabled = false;
+
+static double interval = 0;
+static uint64_t started = 0;
+static struct callback_stats callbacks[STATS_CALLBACKS][STATS_STATES];
+// CPU time of the thread each callback runs on, as of its latest invocation.
+static _Atomic uint64_t thread_cpu[STATS_CALLBACKS];
+
+static const char *callback_names[STATS_CALLBACKS] = {"touch", "tap", "notify", "drag"};
+static const char *state_names[STATS_STATES] = {"idle", "resting", "clicking"};
+
+void stats_init(void) {
+	const char *env = getenv("FASTMIDDLE_STATS");
+	if (env == NULL) {
+		return;
+	}
+
+	interval = atof(env);
+	if (interval <= 0) {
+		interval = 10;
+	}
+	started = stats_clock(CLOCK_MONOTONIC);
+	stats_enabled = true;
+}
+
+// Seconds between two reports, 0 when accounting is off.
+double stats_interval(void) {
+	return interval;
+}
+
+void stats_record(enum stats_callback cb, enum stats_state st, uint64_t start) {
+	if (!stats_enabled) {
+		return;
+	}
+
+	struct callback_stats *s = &callbacks[cb][st];
+	atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&s->ns, stats_clock(CLOCK_MONOTONIC) - start, memory_order_relaxed);
+	atomic_store_explicit(&thread_cpu[cb], stats_clock(CLOCK_THREAD_CPUTIME_ID), memory_order_relaxed);
+}
+
+// frames are the counts of all devices summed up.
+void stats_report(FILE *f, const struct stats_frames *frames) {
+	double elapsed = (stats_clock(CLOCK_MONOTONIC) - started) / 1e9;
+	uint64_t seen = atomic_load_explicit(&frames->seen, memory_order_relaxed);
+	uint64_t suppressed = atomic_load_explicit(&frames->suppressed, memory_order_relaxed);
+	uint64_t late = atomic_load_explicit(&frames->late, memory_order_relaxed);
+	uint64_t wakeups = 0;
+
+	for (int cb = 0; cb < STATS_CALLBACKS; cb++) {
+		for (int st = 0; st < STATS_STATES; st++) {
+			wakeups += atomic_load_explicit(&callbacks[cb][st].calls, memory_order_relaxed);
+		}
+	}
+
+	fprintf(f, "fastmiddle: %.1fs, %.1f wakeups/s, %llu frames (%.1f%% suppressed, %llu late)\n",
+		elapsed,
+		elapsed > 0 ? wakeups / elapsed : 0,
+		(unsigned long long)seen,
+		seen > 0 ? 100.0 * suppressed / seen : 0,
+		(unsigned long long)late);
+
+	for (int cb = 0; cb < STATS_CALLBACKS; cb++) {
+		fprintf(f, "  %-6s thread cpu %.3fs\n", callback_names[cb],
+			atomic_load_explicit(&thread_cpu[cb], memory_order_relaxed) / 1e9);
+
+		for (int st = 0; st < STATS_STATES; st++) {
+			uint64_t calls = atomic_load_explicit(&callbacks[cb][st].calls, memory_order_relaxed);
+			uint64_t ns = atomic_load_explicit(&callbacks[cb][st].ns, memory_order_relaxed);
+			if (calls > 0) {
+				fprintf(f, "    %-8s %10llu calls %8.1f/s %8llu ns/call\n", state_names[st],
+					(unsigned long long)calls, calls / elapsed, (unsigned long long)(ns / calls));
+			}
+		}
+	}
+	fflush(f);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Callbacks whose cost is accounted separately. Each runs on its own thread:
+// MultitouchSupport delivery, the event tap run loop and the main run loop. The drag
+// tap shares the run loop of the click tap.
+enum stats_callback {
+	STATS_TOUCH,
+	STATS_TAP,
+	STATS_NOTIFY,
+	STATS_DRAG,
+	STATS_CALLBACKS
+};
+
+// What the user is doing when a callback fires.
+enum stats_state {
+	STATS_IDLE,     // nothing on the surface
+	STATS_RESTING,  // contacts on the surface, no middle click latched
+	STATS_CLICKING, // middle click latched
+	STATS_STATES
+};
+
+// Frame counts of one device. They live in its slot and only the thread delivering its
+// frames writes them, so devices never share a counter, the report sums them up.
+struct stats_frames {
+	_Atomic uint64_t seen;       // every frame delivered, also the watchdog's heartbeat
+	_Atomic uint64_t suppressed; // no change from the previous one
+	_Atomic uint64_t late;       // stale or trailing the other devices
+};
+
+// Set by stats_init when FASTMIDDLE_STATS is set in the environment.
+extern bool stats_enabled;
+
+void stats_init(void);
+double stats_interval(void);
+void stats_record(enum stats_callback cb, enum stats_state st, uint64_t start);
+void stats_report(FILE *f, const struct stats_frames *frames);
+
+// Counts one on a counter with a single writer, without a read-modify-write.
+static inline void stats_count(_Atomic uint64_t *counter) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static inline void stats_frames_add(struct stats_frames *to, const struct stats_frames *from) {
+	atomic_fetch_add_explicit(&to->seen, atomic_load_explicit(&from->seen, memory_order_relaxed), memory_order_relaxed);
+	atomic_fetch_add_explicit(&to->suppressed, atomic_load_explicit(&from->suppressed, memory_order_relaxed),
+		memory_order_relaxed);
+	atomic_fetch_add_explicit(&to->late, atomic_load_explicit(&from->late, memory_order_relaxed), memory_order_relaxed);
+}
+
+static inline uint64_t stats_clock(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns the start timestamp to hand to stats_record, or 0 when accounting is off.
+static inline uint64_t stats_begin(void) {
+	return stats_enabled ? stats_clock(CLOCK_MONOTONIC) : 0;
+}
@@ -0,0 +1,730 @@
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/*
+ * Touch traces are a stream of records after a 4 byte magic. Every record starts
+ * with a tag byte, integers are LEB128 varints and signed ones are zigzag encoded.
+ * Timestamps are microseconds relative to the previous record, devices are registry
+ * slots at the time of recording and what a slot holds is given by the latest DEVICE
+ * record for it, slots get reused across hotplugs.
+ *
+ *   FRAME   device, dt, n, then per contact in identifier order: identifier delta
+ *           from the previous contact, state, x, y and size as deltas from the same
+ *           identifier in the device's previous frame (or from 0 if it is new)
+ *   REPEAT  device, count, dt: count frames identical to the device's previous one,
+ *           each dt after the last
+ *   CLICK   dt, flags (bit 0 button down, bit 1 turned into a middle click)
+ *   BLOCK   no payload, resets the delta state as if the trace started here
+ *   DEVICE  device, dt, family, product, builtin: the device registered in the slot, dt
+ *           is 0 but at the start of a block
+ *
+ * A BLOCK record starts the trace and then every BLOCK_SIZE bytes or so. Each one gets
+ * an entry in the <path>.idx sidecar with its offset, the timestamp of its first record
+ * and the number of clicks before it, so readers can binary search to any time or click
+ * and start decoding from there.
+ *
+ * Recording never does I/O on the callers' threads, the touch callbacks and the event
+ * tap only copy their event into a bounded queue. A writer thread drains it every
+ * TRACE_WRITER_MS, encodes and writes. Events that find the queue full are dropped and
+ * counted in the report.
+ */
+
+#define TRACE_MAGIC "FMT1"
+#define POS_SCALE 4096
+#define SIZE_SCALE 256
+#define BLOCK_SIZE (1 << 16)
+// Longest possible record: tag, three varints and MAX_CONTACTS contacts of five varints.
+#define MAX_RECORD (1 + 3 * 10 + MAX_CONTACTS * 5 * 10)
+// Events the queue holds, a power of two, and milliseconds the writer sleeps between drains.
+#ifndef TRACE_QUEUE
+#define TRACE_QUEUE 1024
+#endif
+#ifndef TRACE_WRITER_MS
+#define TRACE_WRITER_MS 10
+#endif
+
+enum trace_tag {
+	TAG_FRAME = 1,
+	TAG_REPEAT = 2,
+	TAG_CLICK = 3,
+	TAG_BLOCK = 4,
+	TAG_DEVICE = 5,
+};
+
+bool trace_enabled = false;
+
+// Queue slot, seq is the ticket it was last filled for plus one while it holds an event
+// and the ticket it is free for otherwise.
+struct trace_slot {
+	_Atomic uint64_t seq;
+	uint32_t raw_size;
+	struct trace_event ev;
+};
+
+static struct trace_slot *queue;
+static _Atomic uint64_t queue_tail = 0; // next ticket to hand to a producer
+static uint64_t queue_head = 0;          // next ticket the writer reads, writer only
+static _Atomic uint64_t dropped = 0;
+static _Atomic bool flush_requested = false;
+static _Atomic bool writer_stop = false;
+static pthread_t writer;
+static bool writer_running = false;
+
+// Everything below is only touched by the writer thread, but for the byte counts the
+// report reads.
+static FILE *out;
+static FILE *index_out;
+static struct trace_codec codec;
+// Run of unchanged frames not written out yet.
+static struct {
+	int device;
+	int count;
+	int64_t dt;
+} run;
+// Bytes a raw dump of the frames would have taken, bytes actually written and the time
+// the writer spent encoding them.
+static _Atomic uint64_t raw_bytes;
+static _Atomic uint64_t encoded_bytes;
+static _Atomic uint64_t encode_ns;
+// Where the current block started in encoded_bytes, and clicks written so far.
+static uint64_t block_start;
+static bool block_open = false;
+static uint64_t clicks;
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static inline uint8_t *put_signed(uint8_t *p, int64_t v) {
+	return put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static inline bool get_varint(struct trace_reader *r, uint64_t *v) {
+	uint64_t result = 0;
+
+	for (int shift = 0; r->p < r->end && shift < 64; shift += 7) {
+		uint8_t b = *r->p++;
+		result |= (uint64_t)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			*v = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline bool get_signed(struct trace_reader *r, int64_t *v) {
+	uint64_t u;
+
+	if (!get_varint(r, &u)) {
+		return false;
+	}
+	*v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+	return true;
+}
+
+static inline uint64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline int64_t to_us(double timestamp) {
+	return llround(timestamp * 1e6);
+}
+
+// Returns the contact with the identifier in the previous frame, contacts are sorted by identifier.
+static inline const struct trace_contact *find_prev(const struct trace_contact *prev, int len, int32_t identifier) {
+	for (int i = 0; i < len && prev[i].identifier <= identifier; i++) {
+		if (prev[i].identifier == identifier) {
+			return &prev[i];
+		}
+	}
+	return NULL;
+}
+
+static inline void write_record(const uint8_t *buf, size_t len) {
+	fwrite(buf, 1, len, out);
+	atomic_store_explicit(&encoded_bytes, atomic_load_explicit(&encoded_bytes, memory_order_relaxed) + len,
+		memory_order_relaxed);
+}
+
+static inline void flush_run() {
+	uint8_t buf[MAX_RECORD];
+	uint8_t *p = buf;
+
+	if (run.count == 0) {
+		return;
+	}
+	*p++ = TAG_REPEAT;
+	p = put_varint(p, run.device);
+	p = put_varint(p, run.count);
+	p = put_signed(p, run.dt);
+	write_record(buf, p - buf);
+	run.count = 0;
+}
+
+// Starts a new block before a record stamped us once the current one is full.
+static inline void block_begin(int64_t us) {
+	uint8_t tag = TAG_BLOCK;
+
+	uint64_t written = atomic_load_explicit(&encoded_bytes, memory_order_relaxed);
+
+	if (block_open && written - block_start < BLOCK_SIZE) {
+		return;
+	}
+	flush_run();
+	written = atomic_load_explicit(&encoded_bytes, memory_order_relaxed);
+	memset(&codec, 0, sizeof(codec));
+	block_start = written;
+	block_open = true;
+
+	struct trace_index_entry entry = {
+		.offset = 4 + written,
+		.timestamp_us = us,
+		.clicks = clicks
+	};
+	write_record(&tag, 1);
+	if (index_out != NULL) {
+		fwrite(&entry, sizeof(entry), 1, index_out);
+	}
+}
+
+static void encode_frame(int device, double timestamp, const struct contact *contacts, int n) {
+	struct trace_contact q[MAX_CONTACTS];
+	uint8_t buf[MAX_RECORD];
+	uint8_t *p = buf;
+
+	// Quantize and sort by identifier so unchanged contacts line up with the previous frame.
+	for (int i = 0; i < n; i++) {
+		struct trace_contact c = {
+			.identifier = contacts[i].identifier,
+			.state = contacts[i].state,
+			.x = lroundf(contacts[i].x * POS_SCALE),
+			.y = lroundf(contacts[i].y * POS_SCALE),
+			.size = lroundf(contacts[i].size * SIZE_SCALE)
+		};
+		int j = i;
+		for (; j > 0 && q[j - 1].identifier > c.identifier; j--) {
+			q[j] = q[j - 1];
+		}
+		q[j] = c;
+	}
+
+	int64_t us = to_us(timestamp);
+	block_begin(us);
+	int64_t dt = us - codec.last_us;
+	codec.last_us = us;
+
+	int prev_len = codec.prev[device].len;
+	const struct trace_contact *prev = codec.prev[device].contacts;
+	if (n == prev_len && memcmp(q, prev, n * sizeof(*q)) == 0) {
+		if (run.count > 0 && (run.device != device || run.dt != dt)) {
+			flush_run();
+		}
+		run.device = device;
+		run.dt = dt;
+		run.count++;
+		return;
+	}
+	flush_run();
+
+	*p++ = TAG_FRAME;
+	p = put_varint(p, device);
+	p = put_signed(p, dt);
+	p = put_varint(p, n);
+	for (int i = 0; i < n; i++) {
+		const struct trace_contact *c = &q[i];
+		const struct trace_contact *base = find_prev(prev, prev_len, c->identifier);
+		struct trace_contact zero = {0};
+		if (base == NULL) {
+			base = &zero;
+		}
+
+		p = put_signed(p, c->identifier - (i > 0 ? q[i - 1].identifier : 0));
+		p = put_varint(p, (uint32_t)c->state);
+		p = put_signed(p, c->x - base->x);
+		p = put_signed(p, c->y - base->y);
+		p = put_signed(p, c->size - base->size);
+	}
+	write_record(buf, p - buf);
+
+	codec.prev[device].len = n;
+	memcpy(codec.prev[device].contacts, q, n * sizeof(*q));
+}
+
+static void encode_click(double timestamp, bool down, bool middle) {
+	uint8_t buf[MAX_RECORD];
+	uint8_t *p = buf;
+
+	flush_run();
+
+	int64_t us = to_us(timestamp);
+	block_begin(us);
+	*p++ = TAG_CLICK;
+	p = put_signed(p, us - codec.last_us);
+	*p++ = down | middle << 1;
+	codec.last_us = us;
+	clicks++;
+	write_record(buf, p - buf);
+}
+
+static void encode_device(int device, const struct trace_device *profile) {
+	uint8_t buf[MAX_RECORD];
+	uint8_t *p = buf;
+
+	flush_run();
+
+	// Stamped with the previous record, which a new block needs carried over from 0.
+	int64_t us = codec.last_us;
+	block_begin(us);
+	*p++ = TAG_DEVICE;
+	p = put_varint(p, device);
+	p = put_signed(p, us - codec.last_us);
+	p = put_varint(p, (uint32_t)profile->family);
+	p = put_varint(p, (uint32_t)profile->product);
+	*p++ = profile->builtin;
+	codec.last_us = us;
+	write_record(buf, p - buf);
+}
+
+// Encodes whatever the producers have finished queueing.
+static void drain() {
+	uint64_t start = monotonic_ns();
+
+	for (;;) {
+		struct trace_slot *slot = &queue[queue_head % TRACE_QUEUE];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue_head + 1) {
+			break;
+		}
+		const struct trace_event *ev = &slot->ev;
+		if (ev->kind == TRACE_FRAME) {
+			atomic_store_explicit(&raw_bytes, atomic_load_explicit(&raw_bytes, memory_order_relaxed) + slot->raw_size,
+				memory_order_relaxed);
+			encode_frame(ev->device, ev->timestamp, ev->contacts, ev->len);
+		} else if (ev->kind == TRACE_DEVICE) {
+			encode_device(ev->device, &ev->profile);
+		} else {
+			encode_click(ev->timestamp, ev->down, ev->middle);
+		}
+		atomic_store_explicit(&slot->seq, queue_head + TRACE_QUEUE, memory_order_release);
+		queue_head++;
+	}
+	atomic_store_explicit(&encode_ns, atomic_load_explicit(&encode_ns, memory_order_relaxed) + monotonic_ns() - start,
+		memory_order_relaxed);
+}
+
+static void *writer_run(void *arg) {
+	struct timespec period = {TRACE_WRITER_MS / 1000, TRACE_WRITER_MS % 1000 * 1000000L};
+
+	for (;;) {
+		// Read first, so everything queued before trace_close is drained.
+		bool stop = atomic_load(&writer_stop);
+		drain();
+		if (atomic_exchange(&flush_requested, false) || stop) {
+			flush_run();
+			fflush(out);
+			if (index_out != NULL) {
+				fflush(index_out);
+			}
+		}
+		if (stop) {
+			return NULL;
+		}
+		nanosleep(&period, NULL);
+	}
+}
+
+// Claims a queue slot, or returns NULL and counts the event dropped when the writer is
+// a whole queue behind.
+static inline struct trace_slot *enqueue_begin() {
+	uint64_t ticket = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+
+	for (;;) {
+		struct trace_slot *slot = &queue[ticket % TRACE_QUEUE];
+		uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq == ticket) {
+			if (atomic_compare_exchange_weak_explicit(&queue_tail, &ticket, ticket + 1,
+				memory_order_relaxed, memory_order_relaxed)) {
+				return slot;
+			}
+		} else if (seq < ticket) {
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return NULL;
+		} else {
+			ticket = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+		}
+	}
+}
+
+static inline void enqueue_end(struct trace_slot *slot) {
+	uint64_t ticket = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, ticket + 1, memory_order_release);
+}
+
+// Releases what a trace_open that didn't get as far as starting the writer left behind.
+static bool open_failed() {
+	if (index_out != NULL) {
+		fclose(index_out);
+		index_out = NULL;
+	}
+	if (out != NULL) {
+		fclose(out);
+		out = NULL;
+	}
+	free(queue);
+	queue = NULL;
+	return false;
+}
+
+bool trace_open(const char *path) {
+	char index_path[4096];
+
+	queue = calloc(TRACE_QUEUE, sizeof(*queue));
+	if (queue == NULL) {
+		return false;
+	}
+	for (uint64_t i = 0; i < TRACE_QUEUE; i++) {
+		atomic_init(&queue[i].seq, i);
+	}
+	out = fopen(path, "wb");
+	if (out == NULL) {
+		return open_failed();
+	}
+	setvbuf(out, NULL, _IOFBF, 1 << 16);
+	if (fwrite(TRACE_MAGIC, 1, 4, out) != 4) {
+		return open_failed();
+	}
+
+	// The trace stays readable without its index, it just can't be seeked.
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	index_out = fopen(index_path, "wb");
+	if (pthread_create(&writer, NULL, writer_run, NULL) != 0) {
+		return open_failed();
+	}
+	writer_running = true;
+	// The app quits without going through state_cleanup.
+	atexit(trace_close);
+	trace_enabled = true;
+	return true;
+}
+
+void trace_frame(int device, double timestamp, const struct contact *contacts, int n, size_t raw_size) {
+	if (!trace_enabled || device < 0 || device >= TRACE_MAX_DEVICES) {
+		return;
+	}
+	struct trace_slot *slot = enqueue_begin();
+	if (slot == NULL) {
+		return;
+	}
+	slot->raw_size = (uint32_t)raw_size;
+	slot->ev.kind = TRACE_FRAME;
+	slot->ev.device = device;
+	slot->ev.timestamp = timestamp;
+	slot->ev.len = n < MAX_CONTACTS ? n : MAX_CONTACTS;
+	memcpy(slot->ev.contacts, contacts, slot->ev.len * sizeof(*contacts));
+	enqueue_end(slot);
+}
+
+void trace_click(double timestamp, bool down, bool middle) {
+	if (!trace_enabled) {
+		return;
+	}
+	struct trace_slot *slot = enqueue_begin();
+	if (slot == NULL) {
+		return;
+	}
+	slot->ev.kind = TRACE_CLICK;
+	slot->ev.timestamp = timestamp;
+	slot->ev.down = down;
+	slot->ev.middle = middle;
+	enqueue_end(slot);
+}
+
+void trace_device(int device, const struct trace_device *profile) {
+	if (!trace_enabled || device < 0 || device >= TRACE_MAX_DEVICES) {
+		return;
+	}
+	struct trace_slot *slot = enqueue_begin();
+	if (slot == NULL) {
+		return;
+	}
+	slot->ev.kind = TRACE_DEVICE;
+	slot->ev.device = device;
+	slot->ev.profile = *profile;
+	enqueue_end(slot);
+}
+
+// Asks the writer to get what it has out to the file on its next round.
+void trace_flush(void) {
+	if (trace_enabled) {
+		atomic_store(&flush_requested, true);
+	}
+}
+
+// Drains the queue into the file and stops the writer, events traced afterwards stay queued.
+void trace_close(void) {
+	if (!writer_running) {
+		return;
+	}
+	writer_running = false;
+	atomic_store(&writer_stop, true);
+	pthread_join(writer, NULL);
+}
+
+void trace_report(FILE *f) {
+	if (!trace_enabled) {
+		return;
+	}
+
+	uint64_t raw = atomic_load_explicit(&raw_bytes, memory_order_relaxed);
+	uint64_t encoded = atomic_load_explicit(&encoded_bytes, memory_order_relaxed);
+	uint64_t ns = atomic_load_explicit(&encode_ns, memory_order_relaxed);
+	fprintf(f, "  trace  %.2f MB raw -> %.2f MB written (%.1fx) encoding %.0f MB/s, %llu events dropped\n",
+		raw / 1e6, encoded / 1e6, encoded > 0 ? (double)raw / encoded : 0, ns > 0 ? raw * 1e3 / ns : 0,
+		(unsigned long long)atomic_load_explicit(&dropped, memory_order_relaxed));
+}
+
+bool trace_reader_init(struct trace_reader *r, const void *data, size_t len) {
+	if (len < 4 || memcmp(data, TRACE_MAGIC, 4) != 0) {
+		return false;
+	}
+	memset(r, 0, sizeof(*r));
+	r->p = (const uint8_t *)data + 4;
+	r->end = (const uint8_t *)data + len;
+	return true;
+}
+
+static inline void emit_frame(struct trace_reader *r, int device, struct trace_event *ev) {
+	ev->kind = TRACE_FRAME;
+	ev->timestamp = r->codec.last_us / 1e6;
+	ev->device = device;
+	ev->len = r->codec.prev[device].len;
+	for (int i = 0; i < ev->len; i++) {
+		const struct trace_contact *c = &r->codec.prev[device].contacts[i];
+		ev->contacts[i] = (struct contact) {
+			.identifier = c->identifier,
+			.state = c->state,
+			.x = (float)c->x / POS_SCALE,
+			.y = (float)c->y / POS_SCALE,
+			.size = (float)c->size / SIZE_SCALE
+		};
+	}
+}
+
+static enum trace_kind read_frame(struct trace_reader *r, struct trace_event *ev) {
+	uint64_t device, n, state;
+	int64_t dt;
+	struct trace_contact q[MAX_CONTACTS];
+
+	if (!get_varint(r, &device) || device >= TRACE_MAX_DEVICES || !get_signed(r, &dt)
+		|| !get_varint(r, &n) || n > MAX_CONTACTS) {
+		return TRACE_ERROR;
+	}
+
+	int prev_len = r->codec.prev[device].len;
+	const struct trace_contact *prev = r->codec.prev[device].contacts;
+	for (uint64_t i = 0; i < n; i++) {
+		int64_t id, dx, dy, dsize;
+		if (!get_signed(r, &id) || !get_varint(r, &state) || !get_signed(r, &dx)
+			|| !get_signed(r, &dy) || !get_signed(r, &dsize)) {
+			return TRACE_ERROR;
+		}
+
+		q[i].identifier = (int32_t)id + (i > 0 ? q[i - 1].identifier : 0);
+		const struct trace_contact *base = find_prev(prev, prev_len, q[i].identifier);
+		struct trace_contact zero = {0};
+		if (base == NULL) {
+			base = &zero;
+		}
+		q[i].state = (int32_t)state;
+		q[i].x = base->x + (int32_t)dx;
+		q[i].y = base->y + (int32_t)dy;
+		q[i].size = base->size + (int32_t)dsize;
+	}
+
+	r->codec.last_us += dt;
+	r->codec.prev[device].len = (int)n;
+	memcpy(r->codec.prev[device].contacts, q, n * sizeof(*q));
+	emit_frame(r, (int)device, ev);
+	return TRACE_FRAME;
+}
+
+enum trace_kind trace_next(struct trace_reader *r, struct trace_event *ev) {
+	uint64_t device, count, family, product;
+	int64_t dt;
+
+	if (r->repeat_count > 0) {
+		r->repeat_count--;
+		r->codec.last_us += r->repeat_dt;
+		emit_frame(r, r->repeat_device, ev);
+		return ev->kind;
+	}
+	if (r->p >= r->end) {
+		return ev->kind = TRACE_END;
+	}
+
+	switch (*r->p++) {
+	case TAG_FRAME:
+		return ev->kind = read_frame(r, ev);
+
+	case TAG_REPEAT:
+		if (!get_varint(r, &device) || device >= TRACE_MAX_DEVICES || !get_varint(r, &count)
+			|| count == 0 || !get_signed(r, &dt)) {
+			return ev->kind = TRACE_ERROR;
+		}
+		r->repeat_device = (int)device;
+		r->repeat_count = (int)count;
+		r->repeat_dt = dt;
+		return trace_next(r, ev);
+
+	case TAG_CLICK:
+		if (!get_signed(r, &dt) || r->p >= r->end) {
+			return ev->kind = TRACE_ERROR;
+		}
+		r->codec.last_us += dt;
+		ev->kind = TRACE_CLICK;
+		ev->timestamp = r->codec.last_us / 1e6;
+		ev->down = *r->p & 1;
+		ev->middle = *r->p++ >> 1 & 1;
+		return TRACE_CLICK;
+
+	case TAG_BLOCK:
+		memset(&r->codec, 0, sizeof(r->codec));
+		return trace_next(r, ev);
+
+	case TAG_DEVICE:
+		if (!get_varint(r, &device) || device >= TRACE_MAX_DEVICES || !get_signed(r, &dt)
+			|| !get_varint(r, &family) || !get_varint(r, &product) || r->p >= r->end) {
+			return ev->kind = TRACE_ERROR;
+		}
+		r->codec.last_us += dt;
+		ev->kind = TRACE_DEVICE;
+		ev->timestamp = r->codec.last_us / 1e6;
+		ev->device = (int)device;
+		ev->profile = (struct trace_device) {
+			.family = (int)(uint32_t)family,
+			.product = (int)(uint32_t)product,
+			.builtin = *r->p++ & 1
+		};
+		return TRACE_DEVICE;
+
+	default:
+		return ev->kind = TRACE_ERROR;
+	}
+}
+
+static void *map_file(const char *path, size_t *len) {
+	struct stat st;
+	void *data = NULL;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			data = NULL;
+		} else {
+			*len = st.st_size;
+		}
+	}
+	close(fd);
+	return data;
+}
+
+bool trace_map(struct trace_file *f, const char *path) {
+	char index_path[4096];
+	memset(f, 0, sizeof(*f));
+	f->data = map_file(path, &f->len);
+	if (f->data == NULL || f->len < 4 || memcmp(f->data, TRACE_MAGIC, 4) != 0) {
+		trace_unmap(f);
+		return false;
+	}
+
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	f->index = map_file(index_path, &f->index_len);
+	f->blocks = f->index_len / sizeof(struct trace_index_entry);
+	// Entries past the end of the trace were written after the trace buffer was last flushed.
+	while (f->blocks > 0 && f->index[f->blocks - 1].offset >= f->len) {
+		f->blocks--;
+	}
+	return true;
+}
+
+void trace_unmap(struct trace_file *f) {
+	if (f->data != NULL) {
+		munmap((void *)f->data, f->len);
+	}
+	if (f->index != NULL) {
+		munmap((void *)f->index, f->index_len);
+	}
+	memset(f, 0, sizeof(*f));
+}
+
+static inline void reader_at_block(struct trace_reader *r, const struct trace_file *f, size_t block) {
+	trace_reader_init(r, f->data, f->len);
+	if (block < f->blocks) {
+		r->p = f->data + f->index[block].offset;
+	}
+}
+
+enum trace_kind trace_seek_time(struct trace_reader *r, const struct trace_file *f, double timestamp, struct trace_event *ev) {
+	int64_t us = to_us(timestamp);
+	size_t lo = 0, hi = f->blocks;
+
+	// Last block starting at or before the timestamp.
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (f->index[mid].timestamp_us <= us) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	reader_at_block(r, f, lo);
+
+	enum trace_kind kind;
+	while ((kind = trace_next(r, ev)) != TRACE_END && kind != TRACE_ERROR && ev->timestamp < timestamp);
+	return kind;
+}
+
+enum trace_kind trace_seek_click(struct trace_reader *r, const struct trace_file *f, uint64_t click, struct trace_event *ev) {
+	size_t lo = 0, hi = f->blocks;
+
+	// Last block with at most click clicks before it.
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (f->index[mid].clicks <= click) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	reader_at_block(r, f, lo);
+
+	uint64_t seen = lo < f->blocks ? f->index[lo].clicks : 0;
+	enum trace_kind kind;
+	while ((kind = trace_next(r, ev)) != TRACE_END && kind != TRACE_ERROR) {
+		if (kind == TRACE_CLICK && seen++ == click) {
+			break;
+		}
+	}
+	return kind;
+}
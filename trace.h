@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "decode.h"
+
+// Devices beyond this are not recorded.
+#define TRACE_MAX_DEVICES 64
+
+// Clock MultitouchSupport frame timestamps are based on, used to stamp clicks.
+#ifdef __APPLE__
+#define TRACE_CLOCK CLOCK_UPTIME_RAW
+#else
+#define TRACE_CLOCK CLOCK_MONOTONIC
+#endif
+
+enum trace_kind {
+	TRACE_END,
+	TRACE_FRAME,
+	TRACE_CLICK,
+	TRACE_DEVICE,
+	TRACE_ERROR,
+};
+
+// What a registry slot holds from a device record on, the most a device tells about itself.
+struct trace_device {
+	int family;
+	int product;
+	bool builtin;
+};
+
+struct trace_event {
+	enum trace_kind kind;
+	double timestamp;
+	int device; // frames and devices
+	int len;    // frames only
+	struct contact contacts[MAX_CONTACTS];
+	bool down;   // clicks only
+	bool middle; // clicks only, whether the click was turned into a middle click
+	struct trace_device profile; // devices only
+};
+
+// Contact as stored in a trace: positions on a 4096 grid, size in 1/256.
+struct trace_contact {
+	int32_t identifier;
+	int32_t state;
+	int32_t x;
+	int32_t y;
+	int32_t size;
+};
+
+// Delta state that encoder and decoder keep in lockstep.
+struct trace_codec {
+	int64_t last_us;
+	struct {
+		int len;
+		struct trace_contact contacts[MAX_CONTACTS];
+	} prev[TRACE_MAX_DEVICES];
+};
+
+struct trace_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	struct trace_codec codec;
+	// Unchanged frames still to be replayed from a run-length record.
+	int repeat_device;
+	int repeat_count;
+	int64_t repeat_dt;
+};
+
+// Entry of the <path>.idx sidecar, one per block.
+struct trace_index_entry {
+	uint64_t offset;      // of the block in the trace file
+	int64_t timestamp_us; // of the first record in the block
+	uint64_t clicks;      // recorded before the block
+};
+
+// Trace and index mapped read-only, decoded in place.
+struct trace_file {
+	const uint8_t *data;
+	size_t len;
+	const struct trace_index_entry *index;
+	size_t index_len;
+	size_t blocks;
+};
+
+// Set by trace_open once a trace file is being recorded.
+extern bool trace_enabled;
+
+bool trace_open(const char *path);
+// raw_size is what the frame took in MultitouchSupport's layout, only used for the report.
+void trace_frame(int device, double timestamp, const struct contact *contacts, int n, size_t raw_size);
+void trace_click(double timestamp, bool down, bool middle);
+// Records the device a slot holds from now on, before its first frame. The record takes the
+// time of the one before it, frames may not be stamped on any clock the caller can read.
+void trace_device(int device, const struct trace_device *profile);
+void trace_flush(void);
+void trace_close(void);
+void trace_report(FILE *f);
+
+bool trace_reader_init(struct trace_reader *r, const void *data, size_t len);
+enum trace_kind trace_next(struct trace_reader *r, struct trace_event *ev);
+
+bool trace_map(struct trace_file *f, const char *path);
+void trace_unmap(struct trace_file *f);
+// Both decode into ev the first event at or after the timestamp, or the click with the
+// given 0-based number, and leave the reader positioned right after it.
+enum trace_kind trace_seek_time(struct trace_reader *r, const struct trace_file *f, double timestamp, struct trace_event *ev);
+enum trace_kind trace_seek_click(struct trace_reader *r, const struct trace_file *f, uint64_t click, struct trace_event *ev);
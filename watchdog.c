@@ -0,0 +1,118 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "stats.h"
+#include "watchdog.h"
+
+// The run loop beats every WATCHDOG_BEAT_MS from a timer and is taken for stalled after
+// WATCHDOG_STALL_MS without one, so a stall is noticed within the sum of the two.
+#ifndef WATCHDOG_BEAT_MS
+#define WATCHDOG_BEAT_MS 2000
+#endif
+#ifndef WATCHDOG_STALL_MS
+#define WATCHDOG_STALL_MS 6000
+#endif
+
+struct component_health {
+	_Atomic uint64_t failed_since; // ns on WATCHDOG_CLOCK, 0 while healthy
+	_Atomic uint64_t recoveries;
+	_Atomic uint64_t recovery_ns;
+	_Atomic uint64_t max_recovery_ns;
+};
+
+static struct component_health health[WATCHDOG_COMPONENTS];
+static _Atomic uint64_t last_beat = 0;
+static void (*on_stall)(void *ctx);
+static void *stall_ctx;
+
+static const char *component_names[WATCHDOG_COMPONENTS] = {"tap", "run loop", "devices", "notifications"};
+
+static void *watchdog_run(void *arg) {
+	struct timespec period = {WATCHDOG_BEAT_MS / 1000, WATCHDOG_BEAT_MS % 1000 * 1000000L};
+
+	for (;;) {
+		nanosleep(&period, NULL);
+
+		uint64_t beat = atomic_load(&last_beat);
+		uint64_t now = stats_clock(WATCHDOG_CLOCK);
+		if (beat == 0 || now - beat < WATCHDOG_STALL_MS * 1000000ull) {
+			continue;
+		}
+		if (!watchdog_failing(WATCHDOG_LOOP)) {
+			watchdog_failed(WATCHDOG_LOOP, beat);
+		}
+		on_stall(stall_ctx);
+	}
+	return NULL;
+}
+
+void watchdog_start(void (*stalled)(void *ctx), void *ctx) {
+	pthread_t thread;
+
+	if (on_stall != NULL) {
+		return;
+	}
+	on_stall = stalled;
+	stall_ctx = ctx;
+	if (pthread_create(&thread, NULL, watchdog_run, NULL) != 0) {
+		fputs("Failed to start the watchdog.\n", stderr);
+		return;
+	}
+	pthread_detach(thread);
+}
+
+// Interval of the heartbeat timer on the run loop, in seconds.
+double watchdog_interval(void) {
+	return WATCHDOG_BEAT_MS / 1000.0;
+}
+
+void watchdog_beat(uint64_t now) {
+	atomic_store(&last_beat, now);
+	if (watchdog_failing(WATCHDOG_LOOP)) {
+		watchdog_recovered(WATCHDOG_LOOP, now);
+	}
+}
+
+void watchdog_idle(void) {
+	atomic_store(&last_beat, 0);
+}
+
+void watchdog_failed(enum watchdog_component c, uint64_t since) {
+	uint64_t healthy = 0;
+	atomic_compare_exchange_strong(&health[c].failed_since, &healthy, since);
+}
+
+void watchdog_recovered(enum watchdog_component c, uint64_t now) {
+	struct component_health *h = &health[c];
+	uint64_t since = atomic_exchange(&h->failed_since, 0);
+	if (since == 0) {
+		return;
+	}
+
+	uint64_t ns = now > since ? now - since : 0;
+	atomic_fetch_add(&h->recoveries, 1);
+	atomic_fetch_add(&h->recovery_ns, ns);
+	if (ns > atomic_load(&h->max_recovery_ns)) {
+		atomic_store(&h->max_recovery_ns, ns);
+	}
+	fprintf(stderr, "Watchdog: %s recovered after %.3fs.\n", component_names[c], ns / 1e9);
+}
+
+bool watchdog_failing(enum watchdog_component c) {
+	return atomic_load(&health[c].failed_since) != 0;
+}
+
+void watchdog_report(FILE *f) {
+	for (int c = 0; c < WATCHDOG_COMPONENTS; c++) {
+		struct component_health *h = &health[c];
+		uint64_t n = atomic_load(&h->recoveries);
+		if (n == 0 && !watchdog_failing(c)) {
+			continue;
+		}
+		fprintf(f, "  watchdog %-13s %llu recoveries, %.3fs mean, %.3fs max%s\n", component_names[c],
+			(unsigned long long)n, n > 0 ? atomic_load(&h->recovery_ns) / 1e9 / n : 0,
+			atomic_load(&h->max_recovery_ns) / 1e9, watchdog_failing(c) ? ", failing" : "");
+	}
+	fflush(f);
+}
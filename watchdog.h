@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Clock of every watchdog timestamp. On macOS it stops while asleep, CLOCK_MONOTONIC keeps
+// counting there and a wakeup would look like a run loop stalled for the whole night.
+#ifdef __APPLE__
+#define WATCHDOG_CLOCK CLOCK_UPTIME_RAW
+#else
+#define WATCHDOG_CLOCK CLOCK_MONOTONIC
+#endif
+
+// Parts of the pipeline that can die on their own and are rebuilt on their own.
+enum watchdog_component {
+	WATCHDOG_TAP,     // event tap disabled by macOS
+	WATCHDOG_LOOP,    // run loop no longer iterating
+	WATCHDOG_DEVICES, // multitouch callbacks gone quiet, as they can across sleep
+	WATCHDOG_PORT,    // device notification port invalidated
+	WATCHDOG_COMPONENTS
+};
+
+// Starts the thread that calls stalled with ctx when the run loop misses its heartbeats,
+// again on every check until it beats again.
+void watchdog_start(void (*stalled)(void *ctx), void *ctx);
+// Heartbeat of the run loop, and the mark that it is not supposed to be running.
+void watchdog_beat(uint64_t now);
+void watchdog_idle(void);
+double watchdog_interval(void);
+
+// Failures are timed from since, the last moment the component was known to be fine.
+void watchdog_failed(enum watchdog_component c, uint64_t since);
+void watchdog_recovered(enum watchdog_component c, uint64_t now);
+bool watchdog_failing(enum watchdog_component c);
+void watchdog_report(FILE *f);